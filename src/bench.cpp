@@ -2,6 +2,13 @@
 #include <iostream>
 #include <string.h>
 #include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 #include "engine.h"
 #include "defs.h"
 #include "board.h"
@@ -9,9 +16,11 @@
 #include "new_search.h"
 #include "tt.h"
 #include "sungorus_eval.h"
+#include "nnue.h"
+#include "gen.h"
 
-void bench() {
-    tt.allocate(16);
+void bench(int n_threads) {
+    tt.allocate(16, n_threads);
     
     static const char *Benchmarks[] = {
         #include "bench.csv"
@@ -19,6 +28,7 @@ void bench() {
     };
 
     engine.reset();
+    engine.threads = n_threads;
     engine.max_depth = 12;
     long long total_nodes = 0;
     float total_time = 0.0;
@@ -29,11 +39,222 @@ void bench() {
         think(engine);
         printf("Bench #%2d score: %5d, bestmove: %s, ponder: %s, nodes: %7d, nps: %7dK, elapsed: %8dms\n",
                 i + 1, engine.score, move_to_str(engine.best_move).c_str(), move_to_str(engine.ponder_move).c_str(), engine.nodes, int(float(engine.nodes) / engine.search_time), engine.search_time); 
-        tt.clear();
+        tt.clear(engine.threads);
         total_nodes += engine.nodes;
         total_time += engine.search_time;
     }
     
     printf("Total nps is: %dK\n", int(float(total_nodes) / total_time));
     printf("Total time is %d\n", int(total_time));
+    tt.print_stats();
+    nnue_print_stats();
+}
+
+// micro-benchmark of the nnue accumulator kernels on the bench positions
+void nnue_bench() {
+    static const char *Benchmarks[] = {
+        #include "bench.csv"
+        ""
+    };
+
+    std::vector<Board> boards;
+    for(int i = 0; strcmp(Benchmarks[i], ""); i++)
+        boards.emplace_back(std::string(Benchmarks[i]));
+
+    nnue_acc_bench(boards.data(), boards.size());
+}
+
+// The fen parser trusts its input, so the lines of a dataset are checked before they become boards:
+// six fields split by single spaces, eight ranks of eight squares, a king of each color and the
+// counters in digits.
+static bool valid_fen(const std::string& fen) {
+    std::vector<std::string> fields;
+    size_t begin = 0, end;
+    do {
+        end = std::min(fen.find(' ', begin), fen.size());
+        fields.push_back(fen.substr(begin, end - begin));
+        begin = end + 1;
+    } while(end < fen.size());
+    if(fields.size() != 6)
+        return false;
+
+    int rank = 7, file = 0, white_kings = 0, black_kings = 0;
+    for(char c : fields[0]) {
+        if(c == '/') {
+            if(file != 8 || rank == 0)
+                return false;
+            rank--;
+            file = 0;
+        } else if(c >= '1' && c <= '8') {
+            file += c - '0';
+        } else if(c && strchr("PNBRQKpnbrqk", c)) {
+            white_kings += c == 'K';
+            black_kings += c == 'k';
+            file++;
+        } else {
+            return false;
+        }
+        if(file > 8)
+            return false;
+    }
+    if(rank != 0 || file != 8 || white_kings != 1 || black_kings != 1)
+        return false;
+
+    if(fields[1] != "w" && fields[1] != "b")
+        return false;
+    if(fields[2].empty() || fields[2].size() > 4 || (fields[2] != "-" && fields[2].find_first_not_of("KQkq") != std::string::npos))
+        return false;
+    if(fields[3] != "-" && (fields[3].size() != 2 || fields[3][0] < 'a' || fields[3][0] > 'h' || (fields[3][1] != '3' && fields[3][1] != '6')))
+        return false;
+    for(int i = 4; i < 6; i++) {
+        if(fields[i].empty() || fields[i].size() > 6 || fields[i].find_first_not_of("0123456789") != std::string::npos)
+            return false;
+    }
+    return true;
+}
+
+// the lines that aren't a valid fen are marked and left out of the batches
+static void score_fens_slice(const std::vector<std::string>& fens, std::vector<int>& scores, std::vector<char>& valid, int begin, int end) {
+    std::vector<Board> boards;
+    boards.reserve(NNUE_BATCH_SIZE); // the batch points into it
+    Board* batch[NNUE_BATCH_SIZE];
+    int lines[NNUE_BATCH_SIZE], batch_scores[NNUE_BATCH_SIZE];
+    for(int i = begin; i < end; i++) {
+        valid[i] = valid_fen(fens[i]);
+        if(valid[i]) {
+            lines[boards.size()] = i;
+            boards.emplace_back(fens[i]);
+        }
+        if(boards.size() == NNUE_BATCH_SIZE || (i == end - 1 && !boards.empty())) {
+            for(int b = 0; b < (int)boards.size(); b++)
+                batch[b] = &boards[b];
+            nnue_eval_batch(batch, boards.size(), batch_scores);
+            for(int b = 0; b < (int)boards.size(); b++)
+                scores[lines[b]] = batch_scores[b];
+            boards.clear();
+        }
+    }
+}
+
+// Scores a file with a fen per line with the current net and writes "fen,score" lines (the score is
+// from the side to move's point of view) in the same order, or "fen,error" for the lines that aren't
+// a valid fen. The fens are read in chunks that the threads split between them, so the scores are
+// streamed out as every chunk is done.
+void score_fens(const char* in_path, const char* out_path, int n_threads) {
+    std::ifstream in(in_path);
+    FILE* out = strcmp(out_path, "-") ? fopen(out_path, "w") : stdout;
+    if(!in || !out) {
+        cerr << "Error opening " << (!in ? in_path : out_path) << endl;
+        return;
+    }
+
+    Board first_board; // sets up the tables before the threads use them
+
+    const int chunk_size = 1 << 16;
+    std::vector<std::string> fens;
+    std::vector<int> scores(chunk_size);
+    std::vector<char> valid(chunk_size);
+    std::string line;
+    long long n_positions = 0, n_errors = 0;
+    const auto start_time = std::chrono::steady_clock::now();
+
+    while(in) {
+        fens.clear();
+        while((int)fens.size() < chunk_size && getline(in, line)) {
+            if(!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if(!line.empty())
+                fens.push_back(line);
+        }
+
+        const int n = fens.size();
+        const int slice = (n + n_threads - 1) / n_threads;
+        std::vector<std::thread> workers;
+        for(int begin = 0; begin < n; begin += slice)
+            workers.emplace_back(score_fens_slice, std::cref(fens), std::ref(scores), std::ref(valid), begin, std::min(n, begin + slice));
+        for(int i = 0; i < (int)workers.size(); i++)
+            workers[i].join();
+
+        for(int i = 0; i < n; i++) {
+            if(valid[i])
+                fprintf(out, "%s,%d\n", fens[i].c_str(), scores[i]);
+            else
+                fprintf(out, "%s,error\n", fens[i].c_str());
+            n_errors += !valid[i];
+        }
+        n_positions += n;
+    }
+
+    if(out != stdout)
+        fclose(out);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    cerr << "Scored " << n_positions - n_errors << " positions in " << elapsed.count() << "s, "
+         << int(n_positions / std::max(elapsed.count(), 1e-9)) << " positions/s, "
+         << n_errors << " lines weren't a valid fen" << endl;
+}
+
+// Perft with the legal generator, the last ply is counted without making the moves. The threads
+// take the root moves one at a time and count them on their own copy of the board. With divide the
+// count of every root move is printed, in the order they were generated.
+void perft_bench(const Board& position, int depth, bool divide, int n_threads, int hash_mb) {
+    Board root = position;
+    MoveList moves;
+    moves.set_end(generate_legal_moves(moves.begin(), &root));
+    PerftTable table(hash_mb);
+    std::vector<uint64_t> counts(moves.size(), 1);
+    std::atomic<int> next_move(0);
+    const auto start_time = std::chrono::steady_clock::now();
+
+    auto count_root_moves = [&]() {
+        Board board = root;
+        UndoData undo_data = UndoData(board.king_attackers);
+        for(int i = next_move++; i < moves.size(); i = next_move++) {
+            board.new_make_move(moves[i], undo_data);
+            counts[i] = perft(board, depth - 1, hash_mb ? &table : NULL);
+            board.new_take_back(undo_data);
+        }
+    };
+    if(depth > 0) {
+        std::vector<std::thread> workers;
+        for(int i = 0; i < n_threads; i++)
+            workers.emplace_back(count_root_moves);
+        for(int i = 0; i < (int)workers.size(); i++)
+            workers[i].join();
+    }
+
+    uint64_t nodes = depth > 0 ? 0 : 1;
+    for(int i = 0; depth > 0 && i < moves.size(); i++) {
+        if(divide)
+            printf("%s: %" PRIu64 "\n", move_to_str(moves[i]).c_str(), counts[i]);
+        nodes += counts[i];
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    printf("perft %d: %" PRIu64 " nodes in %.3fs, %dK nodes/s\n",
+           depth, nodes, elapsed.count(), int(nodes / std::max(elapsed.count(), 1e-9) / 1000));
+}
+
+// perft <depth> [divide] [threads <n>] [hash <mb>] [fen], args are the words after perft and the
+// count starts from position when there is no fen
+void perft_command(const std::vector<std::string>& args, const Board& position) {
+    if(args.empty()) {
+        cerr << "Usage: perft <depth> [divide] [threads <n>] [hash <mb>] [fen]" << endl;
+        return;
+    }
+    int depth = atoi(args[0].c_str()), n_threads = 1, hash_mb = 0;
+    bool divide = false;
+    std::string fen;
+    for(int i = 1; i < (int)args.size(); i++) {
+        if(args[i] == "divide")
+            divide = true;
+        else if(args[i] == "threads" && i + 1 < (int)args.size())
+            n_threads = std::max(1, std::min(MAX_THREADS, atoi(args[++i].c_str())));
+        else if(args[i] == "hash" && i + 1 < (int)args.size())
+            hash_mb = std::max(0, std::min(MAX_HASH, atoi(args[++i].c_str())));
+        else if(!args[i].empty())
+            fen += (fen.empty() ? "" : " ") + args[i];
+    }
+    if(fen.empty())
+        perft_bench(position, depth, divide, n_threads, hash_mb);
+    else
+        perft_bench(Board(fen), depth, divide, n_threads, hash_mb);
 }
@@ -1 +1,9 @@
-void bench();
\ No newline at end of file
+#include <string>
+#include <vector>
+#include "board.h"
+
+void bench(int n_threads = 1);
+void nnue_bench();
+void score_fens(const char* in_path, const char* out_path, int n_threads);
+void perft_bench(const Board& position, int depth, bool divide = false, int n_threads = 1, int hash_mb = 0);
+void perft_command(const std::vector<std::string>& args, const Board& position);
@@ -1,5 +1,5 @@
 #include <vector>
-#include <iostream>
+#include <array>
 #include <iostream>
 #include <cassert>
 #include "defs.h"
@@ -7,16 +7,6 @@
 #include "board.h"
 #include "gen.h"
 
-static std::string str_seed = "Dratini is fast!";
-static std::seed_seq seed(str_seed.begin(), str_seed.end());
-static std::mt19937_64 rng(seed);
-static std::uniform_int_distribution<uint64_t> dist(std::llround(std::pow(2, 56)), std::llround(std::pow(2, 62)));
-static bool required_data_initialized = false; // this must be set to false at the beginning
-std::vector<std::vector<uint64_t> > zobrist_pieces;
-std::vector<uint64_t> zobrist_castling;
-std::vector<uint64_t> zobrist_enpassant;
-std::vector<uint64_t> zobrist_side;
-std::vector<int> castling_bitmasks;
 static const int pst[6][64] = {
   { 0, 4, 8, 10, 10, 8, 4, 0, 4, 8, 12, 14, 14, 12, 8, 4, 8, 12, 16, 18, 18, 16, 12, 8, 10, 14, 18, 20, 20, 18, 14, 10, 10, 14, 18, 20, 20, 18, 14, 10, 8, 12, 16, 18, 18, 16, 12, 8, 4, 8, 12, 14, 14, 12, 8, 4, 0, 4, 8, 10, 10, 8, 4, 0 },
   { 0, 8, 16, 20, 20, 16, 8, 0, 8, 16, 24, 28, 28, 24, 16, 8, 16, 24, 32, 36, 36, 32, 24, 16, 20, 28, 36, 40, 40, 36, 28, 20, 20, 28, 36, 40, 40, 36, 28, 20, 16, 24, 32, 36, 36, 32, 24, 16, 8, 16, 24, 28, 28, 24, 16, 8, 0, 8, 16, 20, 20, 16, 8, 0 },
@@ -26,10 +16,121 @@ static const int pst[6][64] = {
   { 0, 12, 24, 30, 30, 24, 12, 0, 12, 24, 36, 42, 42, 36, 24, 12, 24, 36, 48, 54, 54, 48, 36, 24, 30, 42, 54, 60, 60, 54, 42, 30, 30, 42, 54, 60, 60, 54, 42, 30, 24, 36, 48, 54, 54, 48, 36, 24, 12, 24, 36, 42, 42, 36, 24, 12, 0, 12, 24, 30, 30, 24, 12, 0 }
 };
 
-std::vector<std::vector<uint64_t> > pawn_attacks;
-std::vector<uint64_t> knight_attacks;
-std::vector<uint64_t> king_attacks;
-std::vector<uint64_t> castling_mask;
+// The tables are generated at compile time, so they sit in .rodata, shared by every engine
+// process, and a lookup is a single load.
+typedef std::array<uint64_t, 64> SquareTable;
+
+// the squares a (file, rank) step away from sq, if it is on the board
+static constexpr uint64_t step_mask(int sq, int file_step, int rank_step) {
+    const int file = col(sq) + file_step, rank = row(sq) + rank_step;
+    return file >= 0 && file < 8 && rank >= 0 && rank < 8 ? uint64_t(1) << (rank * 8 + file) : 0;
+}
+
+// pawn_attacks[side][sq] are the squares a pawn of side attacks sq from
+static constexpr std::array<SquareTable, 2> make_pawn_attacks() {
+    std::array<SquareTable, 2> table = {};
+    for(int sq = 0; sq < 64; sq++) {
+        table[WHITE][sq] = step_mask(sq, -1, -1) | step_mask(sq, 1, -1);
+        table[BLACK][sq] = step_mask(sq, -1, 1) | step_mask(sq, 1, 1);
+    }
+    return table;
+}
+
+static constexpr SquareTable make_step_attacks(const int (&steps)[8][2]) {
+    SquareTable table = {};
+    for(int sq = 0; sq < 64; sq++)
+        for(int i = 0; i < 8; i++)
+            table[sq] |= step_mask(sq, steps[i][0], steps[i][1]);
+    return table;
+}
+
+static constexpr int knight_steps[8][2] = {{-2, 1}, {-1, 2}, {1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}};
+static constexpr int king_steps[8][2] = {{-1, 0}, {-1, 1}, {0, 1}, {1, 1}, {1, 0}, {1, -1}, {0, -1}, {-1, -1}};
+
+// walks from sq_1 in every direction, when a ray reaches sq_2 the squares walked before it are
+// the ones between them, and the ray together with the opposite one is the line through both
+static constexpr std::array<SquareTable, 64> make_line_table(bool between) {
+    std::array<SquareTable, 64> table = {};
+    for(int sq_1 = 0; sq_1 < 64; sq_1++) {
+        for(int dir = 0; dir < 8; dir++) {
+            const int file_step = king_steps[dir][0], rank_step = king_steps[dir][1];
+            uint64_t ray = 0, back_ray = 0;
+            for(int sq = sq_1; step_mask(sq, -file_step, -rank_step); sq -= rank_step * 8 + file_step)
+                back_ray |= step_mask(sq, -file_step, -rank_step);
+            for(int sq = sq_1; step_mask(sq, file_step, rank_step); sq += rank_step * 8 + file_step) {
+                const int sq_2 = sq + rank_step * 8 + file_step;
+                table[sq_1][sq_2] = between ? ray : 0;
+                ray |= uint64_t(1) << sq_2;
+            }
+            if(!between)
+                for(int sq = sq_1; step_mask(sq, file_step, rank_step); sq += rank_step * 8 + file_step)
+                    table[sq_1][sq + rank_step * 8 + file_step] = ray | back_ray | (uint64_t(1) << sq_1);
+        }
+    }
+    return table;
+}
+
+static constexpr std::array<int, 64> make_castling_bitmasks() {
+    std::array<int, 64> table = {};
+    for(int sq = 0; sq < 64; sq++)
+        table[sq] = 15;
+    table[A1] = 14;
+    table[E1] = 12;
+    table[H1] = 13;
+    table[A8] = 11;
+    table[E8] = 3;
+    table[H8] = 7;
+    return table;
+}
+
+constexpr std::array<SquareTable, 2> pawn_attacks = make_pawn_attacks();
+constexpr SquareTable knight_attacks = make_step_attacks(knight_steps);
+constexpr SquareTable king_attacks = make_step_attacks(king_steps);
+constexpr std::array<uint64_t, 4> castling_mask = {
+    (uint64_t(1) << B1) | (uint64_t(1) << C1) | (uint64_t(1) << D1), // WHITE_QUEEN_SIDE
+    (uint64_t(1) << F1) | (uint64_t(1) << G1), // WHITE_KING_SIDE
+    (uint64_t(1) << B8) | (uint64_t(1) << C8) | (uint64_t(1) << D8), // BLACK_QUEEN_SIDE
+    (uint64_t(1) << F8) | (uint64_t(1) << G8) // BLACK_KING_SIDE
+};
+constexpr std::array<SquareTable, 64> between_squares = make_line_table(true);
+constexpr std::array<SquareTable, 64> line_through = make_line_table(false);
+constexpr std::array<int, 64> castling_bitmasks = make_castling_bitmasks();
+
+// The zobrist keys are the outputs of splitmix64 from a fixed seed, numbered through the tables in
+// order: the pieces, the castling masks, the enpassant columns and the side. Changing the seed or
+// the order changes zobrist_fingerprint, so saved tts get rejected.
+static constexpr uint64_t zobrist_key(int index) {
+    uint64_t z = 0x4472617469696E69ULL + uint64_t(index + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+template<int N>
+static constexpr std::array<uint64_t, N> make_zobrist_keys(int first_index) {
+    std::array<uint64_t, N> table = {};
+    for(int i = 0; i < N; i++)
+        table[i] = zobrist_key(first_index + i);
+    return table;
+}
+
+static constexpr std::array<SquareTable, 12> make_zobrist_pieces() {
+    std::array<SquareTable, 12> table = {};
+    for(int piece = WHITE_PAWN; piece <= BLACK_KING; piece++)
+        table[piece] = make_zobrist_keys<64>(piece * 64);
+    return table;
+}
+
+static constexpr std::array<uint64_t, 9> make_zobrist_enpassant() {
+    std::array<uint64_t, 9> table = make_zobrist_keys<9>(12 * 64 + 16);
+    table[NO_ENPASSANT] = 0;
+    return table;
+}
+
+constexpr std::array<SquareTable, 12> zobrist_pieces = make_zobrist_pieces();
+constexpr std::array<uint64_t, 16> zobrist_castling = make_zobrist_keys<16>(12 * 64); // for each possible mask
+constexpr std::array<uint64_t, 9> zobrist_enpassant = make_zobrist_enpassant();
+constexpr std::array<uint64_t, 2> zobrist_side = make_zobrist_keys<2>(12 * 64 + 16 + 8);
 
 #define get_side_mask(_side) (_side == WHITE ? \
 	(bits[WHITE_PAWN] | bits[WHITE_KNIGHT] | bits[WHITE_BISHOP] | bits[WHITE_ROOK] | bits[WHITE_QUEEN] | bits[WHITE_KING]) : \
@@ -46,136 +147,37 @@ std::vector<uint64_t> castling_mask;
 #define get_color(sq) (color_at[sq])
 #define in_check() bool(king_attackers)
 
-static uint64_t get_random_64() {
-	return dist(rng);
-}
+static bool magics_initialized = false;
 
-// initializes zobrist hashes and bitboard tables
+// the slider databases are the only tables filled at runtime
 static void init_data() {
-    if(required_data_initialized) {
+    if(magics_initialized)
         return;
-	}
-
-	initmagicmoves();
+    initmagicmoves();
+    magics_initialized = true;
+}
 
-    zobrist_pieces.resize(12);
-    for(int piece = WHITE_PAWN; piece <= BLACK_KING; piece++) {
-        zobrist_pieces[piece].resize(64);
+// identifies the zobrist keys, a tt saved with different keys is worthless
+uint64_t zobrist_fingerprint() {
+    init_data();
+    uint64_t fingerprint = 0;
+    auto mix = [&fingerprint](uint64_t key) { fingerprint = (fingerprint ^ key) * 0x9E3779B97F4A7C15ULL; };
+    for(int piece = WHITE_PAWN; piece <= BLACK_KING; piece++)
         for(int sq = 0; sq < 64; sq++)
-            zobrist_pieces[piece][sq] = get_random_64();
-    }
-    
-    zobrist_castling.resize(16); // for each possible mask
+            mix(zobrist_pieces[piece][sq]);
     for(int i = 0; i < 16; i++)
-        zobrist_castling[i] = get_random_64();
-
-    zobrist_enpassant.resize(9);
+        mix(zobrist_castling[i]);
     for(int col = 0; col < 8; col++)
-        zobrist_enpassant[col] = get_random_64();
-    // when there is no enpassant column
-    zobrist_enpassant[NO_ENPASSANT] = 0;
-
-    zobrist_side.resize(2);
+        mix(zobrist_enpassant[col]);
     for(int _side = WHITE; _side <= BLACK; _side++)
-        zobrist_side[_side] = get_random_64();
-
-    // pawn tables
-    pawn_attacks.resize(2);
-    pawn_attacks[WHITE].assign(64, 0);
-    pawn_attacks[BLACK].assign(64, 0);
-    for(int sq = 0; sq < 64; sq++) {
-        int _row = row(sq), _col = col(sq);
-		if(_row > 0 && _col > 0)
-			pawn_attacks[WHITE][sq] |= mask_sq(sq - 9);
-		if(_row > 0 && _col < 7)
-			pawn_attacks[WHITE][sq] |= mask_sq(sq - 7);
-		if(_row < 7 && _col > 0)
-			pawn_attacks[BLACK][sq] |= mask_sq(sq + 7);
-		if(_row < 7 && _col < 7)
-			pawn_attacks[BLACK][sq] |= mask_sq(sq + 9);
-    }
-
-    /* knight tables */
-    knight_attacks.clear();
-    knight_attacks.resize(64);
-    for(int sq = 0; sq < 64; sq++) {
-        int _row = row(sq), _col = col(sq);
-		knight_attacks[sq] = 0;
-        /* one up, two left */
-        if(_col > 1 && _row < 7)
-            knight_attacks[sq] |= mask_sq(sq + 8 - 2);
-        /* two up, one left */
-        if(_col > 0 && _row < 6)
-            knight_attacks[sq] |= mask_sq(sq + 16 - 1);
-        /* two up, one right */
-        if(_col < 7 && _row < 6)
-            knight_attacks[sq] |= mask_sq(sq + 16 + 1);
-        /* one up, two right */
-        if(_col < 6 && _row < 7)
-            knight_attacks[sq] |= mask_sq(sq + 8 + 2);
-        /* one down, two right */
-        if(_col < 6 && _row > 0)
-            knight_attacks[sq] |= mask_sq(sq - 8 + 2);
-        /* two down, one right */
-        if(_col < 7 && _row > 1)
-            knight_attacks[sq] |= mask_sq(sq - 16 + 1);
-        /* two down, one left */
-        if(_col > 0 && _row > 1)
-            knight_attacks[sq] |= mask_sq(sq - 16 - 1);
-        /* one down, two left */
-        if(_col > 1 && _row > 0)
-            knight_attacks[sq] |= mask_sq(sq - 8 - 2);
-    }
-
-    /* king tables */
-    king_attacks.clear();
-    king_attacks.resize(64);
-    for(int sq = 0; sq < 64; sq++) {
-        int _row = row(sq), _col = col(sq);
-        /* one left */
-        if(_col > 0)
-            king_attacks[sq] |= mask_sq(sq - 1);
-        /* one left, one up */
-        if(_col > 0 && _row < 7)
-            king_attacks[sq] |= mask_sq(sq + 7);
-        /* one up */
-        if(_row < 7)
-            king_attacks[sq] |= mask_sq(sq + 8);
-        /* one right, one up */
-        if(_col < 7 && _row < 7)
-            king_attacks[sq] |= mask_sq(sq + 9);
-        /* one right */
-        if(_col < 7)
-            king_attacks[sq] |= mask_sq(sq + 1);
-        /* one right, one down */
-        if(_col < 7 && _row > 0)
-            king_attacks[sq] |= mask_sq(sq - 8 + 1);
-        /* one down */
-        if(_row > 0)
-            king_attacks[sq] |= mask_sq(sq - 8);
-        /* one left, one down */
-        if(_col > 0 && _row > 0)
-            king_attacks[sq] |= mask_sq(sq - 8 - 1);
-    }
-
-	castling_bitmasks.assign(64, 15);
-	castling_bitmasks[A1] = 14;
-	castling_bitmasks[E1] = 12;
-	castling_bitmasks[H1] = 13;
-	castling_bitmasks[A8] = 11;
-	castling_bitmasks[E8] = 3;
-	castling_bitmasks[H8] = 7;
-
-	castling_mask.resize(4);
-	castling_mask[WHITE_QUEEN_SIDE] = mask_sq(B1) | mask_sq(C1) | mask_sq(D1);
-	castling_mask[WHITE_KING_SIDE] = mask_sq(F1) | mask_sq(G1);
-	castling_mask[BLACK_QUEEN_SIDE] = mask_sq(B8) | mask_sq(C8) | mask_sq(D8);
-	castling_mask[BLACK_KING_SIDE] = mask_sq(F8) | mask_sq(G8);
-
-    required_data_initialized = true;
+        mix(zobrist_side[_side]);
+    return fingerprint;
 }
 
 Board::Board() {
+	acc_cache = NULL;
+	nnue_stats = NULL;
+	eval_cache = NULL;
 	occ_mask = 0;
 	b_pst[WHITE] = b_pst[BLACK] = b_mat[WHITE] = b_mat[BLACK] = 0; 
 	castling_flag = 15;
@@ -186,11 +188,14 @@ Board::Board() {
     king_attackers = get_attackers(lsb(get_king_mask(side)), xside, this);
     update_material_values(); // sungorus
 	acc_stack_size = 0;
-	acc_stack[0].has_been_computed = false;
+	acc_stack[0].computed[WHITE] = acc_stack[0].computed[BLACK] = false;
 	move_stack.clear();
 }
 
 Board::Board(const std::string& str) {
+	acc_cache = NULL;
+	nnue_stats = NULL;
+	eval_cache = NULL;
 	occ_mask = 0;
 	b_pst[WHITE] = b_pst[BLACK] = b_mat[WHITE] = b_mat[BLACK] = 0;
 	castling_flag = 15;
@@ -201,7 +206,7 @@ Board::Board(const std::string& str) {
     king_attackers = get_attackers(lsb(get_king_mask(side)), xside, this);
     update_material_values(); // to be able to use sungorus' eval function
 	acc_stack_size = 0;
-	acc_stack[0].has_been_computed = false;
+	acc_stack[0].computed[WHITE] = acc_stack[0].computed[BLACK] = false;
 	move_stack.clear();
 }
 
@@ -305,16 +310,16 @@ void Board::set_from_fen(const std::string& fen) {
 		while(fen[index] != ' ') {
 			switch(fen[index++]) {
 				case 'K':
-					castling_flag |= 8;
+					castling_flag |= 2;
 					break;
 				case 'Q':
-					castling_flag |= 4;
+					castling_flag |= 1;
 					break;
 				case 'k':
-					castling_flag |= 2;
+					castling_flag |= 8;
 					break;
 				case 'q':
-					castling_flag |= 1;
+					castling_flag |= 4;
 					break;
 				default:
 					std::cerr << "Invalid fen string (5)" << endl;
@@ -547,7 +552,7 @@ bool Board::checkmate() {
 	if(!in_check()) {
 		return false;
 	}
-	std::vector<Move> possible_moves;
+	MoveList possible_moves;
 	generate_moves(possible_moves, this);
 	return possible_moves.empty();
 }
@@ -556,7 +561,7 @@ bool Board::stalemate() {
 	if(in_check()) {
 		return false;
 	}
-	std::vector<Move> possible_moves;
+	MoveList possible_moves;
 	generate_moves(possible_moves, this);
 	return possible_moves.empty();
 }
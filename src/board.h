@@ -4,18 +4,25 @@
 #include <cstdint>
 #include <cinttypes>
 #include <vector>
+#include <array>
 #include "defs.h"
 #include "nnue.h"
 
-extern std::vector<std::vector<uint64_t> > pawn_attacks;
-extern std::vector<uint64_t> knight_attacks;
-extern std::vector<uint64_t> king_attacks;
-extern std::vector<uint64_t> castling_mask;
-extern std::vector<std::vector<uint64_t> > zobrist_pieces;
-extern std::vector<uint64_t> zobrist_castling;
-extern std::vector<uint64_t> zobrist_enpassant;
-extern std::vector<uint64_t> zobrist_side;
-extern std::vector<int> castling_bitmasks;
+// generated at compile time in board.cpp
+extern const std::array<std::array<uint64_t, 64>, 2> pawn_attacks;
+extern const std::array<uint64_t, 64> knight_attacks;
+extern const std::array<uint64_t, 64> king_attacks;
+extern const std::array<uint64_t, 4> castling_mask;
+// the squares strictly between two squares on a line, and the whole line through them (0 if they aren't on one)
+extern const std::array<std::array<uint64_t, 64>, 64> between_squares;
+extern const std::array<std::array<uint64_t, 64>, 64> line_through;
+extern const std::array<std::array<uint64_t, 64>, 12> zobrist_pieces;
+extern const std::array<uint64_t, 16> zobrist_castling;
+extern const std::array<uint64_t, 9> zobrist_enpassant;
+extern const std::array<uint64_t, 2> zobrist_side;
+extern const std::array<int, 64> castling_bitmasks;
+
+uint64_t zobrist_fingerprint();
 
 #define clear_square(sq, piece) bits[piece] ^= mask_sq(sq); \
 	b_pst[piece >= BLACK_PAWN ? BLACK : WHITE] -= pst[piece_at[sq]][sq]; \
@@ -103,13 +110,16 @@ struct Board {
     int b_pst[2];
 
     // NNUE accumulator
-    // int oldest_calc_idx; // acc_stack[oldest_calc_idx].has_been_computed = true
-    //                      // acc_stack[oldest_calc_idx - 1].has_been_computed = false
+    // int oldest_calc_idx; // acc_stack[oldest_calc_idx].computed[side] = true
+    //                      // acc_stack[oldest_calc_idx - 1].computed[side] = false
+    // acc_stack and dp_stack are rings indexed with acc_stack_size & (ACC_STACK_SIZE - 1),
+    // dp_stack[i] holds the pieces changed by the move made from acc_stack[i]
     int acc_stack_size;
-    Accumulator acc_stack[8];
-    DirtyPiece dp_stack[8];
-    // Accumulator acc_stack[64];
-    // DirtyPiece dp_stack[64];
+    Accumulator acc_stack[ACC_STACK_SIZE];
+    DirtyPiece dp_stack[ACC_STACK_SIZE];
+    AccumulatorCache* acc_cache; // owned by the search thread, NULL if there is none
+    NnueStats* nnue_stats; // same
+    EvalCache* eval_cache; // same
 
     std::vector<Move> move_stack;
 
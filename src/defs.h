@@ -6,6 +6,9 @@
 #include <iostream>
 #include <cstdint>
 #include <tmmintrin.h>
+#if defined(__BMI__) || defined(__POPCNT__)
+#include <immintrin.h>
+#endif
 
 #define ll long long
 // #define endl '\n'
@@ -15,7 +18,13 @@ using std::cout;
 using std::cin;
 using std::cerr;
 
+// with `make embed` the default net is the one linked into the executable
+#define EMBEDDED_NET_NAME "<embedded>"
+#ifdef EMBEDDED_NET
+#define NNUE_PATH EMBEDDED_NET_NAME
+#else
 #define NNUE_PATH "/Users/balce/maia-net.bin"
+#endif
 
 #define RESET_COLOR "\033[0m"
 #define EMPTY_COLOR "\033[37m"
@@ -36,7 +45,7 @@ using std::cerr;
 #define make_piece(non_side_piece, side) (non_side_piece + (side ? 6 : 0))
 
 typedef uint16_t Move;
-#define Move(from, to, flag) (from | (to << 6) | (flag << 12))
+#define Move(from, to, flag) ((from) | ((to) << 6) | ((flag) << 12))
 #define get_from(move) (move & 63)
 #define get_to(move) ((move >> 6) & 63)
 #define get_flag(move) (move >> 12)
@@ -118,6 +127,9 @@ const int MIN_DEPTH_FOR_WINDOW = 5;
 const int INITIAL_WINDOW_SIZE = 30;
 const int MIN_NULL_MOVE_PRUNING_DEPTH = 2;
 const int MAX_PLY = 32;
+const int MAX_THREADS = 256;
+const int MAX_MOVES = 256; // more than the legal moves of any position
+const int MAX_HASH = 65536;
 const int MIN_BETA_PRUNING_DEPTH = 8;
 const int BETA_MARGIN = 85;
 const int MAX_HISTORY_BONUS = 300;
@@ -148,7 +160,12 @@ const uint64_t _mask_sq[64] = {
     144115188075855872, 288230376151711744, 576460752303423488, 1152921504606846976, 2305843009213693952, 4611686018427387904, 9223372036854775808
 };
 
+// with bmi2 a variable shift (shlx) is cheaper than the load
+#ifdef __BMI2__
+#define mask_sq(sq) (uint64_t(1) << (sq))
+#else
 #define mask_sq(sq) _mask_sq[sq]
+#endif
 
 // inline uint64_t mask_sq(int sq) {
 //     return (uint64_t(1) << sq);
@@ -183,9 +200,15 @@ inline int lsb(uint64_t mask) {
 #endif
 }
 
+// tzcnt and blsr with the bmi build (make archs), bsf and the plain and otherwise
 inline int pop_first_bit(uint64_t& mask) {
+#ifdef __BMI__
+    int index = _tzcnt_u64(mask);
+    mask = _blsr_u64(mask);
+#else
     int index = lsb(mask);
     mask &= mask - 1;
+#endif
     return index;
 }
 
@@ -207,9 +230,13 @@ inline __m128i popcnt_64(__m128i n) {
 }
 
 inline int popcnt(uint64_t mask) {
+#ifdef __POPCNT__
+    return _mm_popcnt_u64(mask);
+#else
     const __m128i n = _mm_set_epi64x(00, mask);
     const __m128i cnt = popcnt_64(n);
     return _mm_cvtsi128_si32(cnt);
+#endif
 }
 
 inline bool valid_pos(const int x) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include "board.h"
 #include "tt.h"
 
@@ -8,7 +9,9 @@ struct Engine {
     int max_depth;
     int nodes, score;
     int search_time;
-    bool stop_search, is_searching, is_pondering;
+    int threads;
+    std::atomic<bool> stop_search;
+    bool is_searching, is_pondering;
     Move best_move, ponder_move;
     int max_search_time;
 
@@ -16,6 +19,7 @@ struct Engine {
         max_depth = 16;
         nodes = score = 0;
         search_time = 0.0;
+        threads = 1;
         stop_search = is_searching = false;
         best_move = ponder_move = NULL_MOVE; 
         max_search_time = 10000;
@@ -5,13 +5,11 @@
 #include "magicmoves.h"
 #include "bitboard.h"
 #include "board.h"
+#include "gen.h"
 
 uint64_t get_attackers(int, bool, const Board*);
 uint64_t get_blockers(int, bool, const Board*);
 uint64_t get_between(int, int, const Board*);
-void generate_evasions(std::vector<Move>&, const Board*);
-void generate_captures(std::vector<Move>&, const Board*);
-void generate_quiet(std::vector<Move>&, const Board*);
 int* new_generate_captures(int* moves, const Board*);
 int* new_generate_quiet(int* moves, const Board*);
 
@@ -30,21 +28,13 @@ int* new_generate_quiet(int* moves, const Board*);
 #define get_color(sq) (board->color_at[sq])
 #define in_check() bool(board->king_attackers)
 
-void generate_moves(std::vector<Move>& moves, const Board* board, bool quiesce) {
-    std::vector<Move> tmp_moves;
-    if(board->king_attackers) {
-        generate_evasions(tmp_moves, board);
-    } else {
-        generate_captures(tmp_moves, board);
-        if(!quiesce) {
-            generate_quiet(tmp_moves, board);
-        }
-    }
-    for(int i = 0; i < (int)tmp_moves.size(); i++) {
-        if(board->fast_move_valid(tmp_moves[i])) {
-            moves.push_back(tmp_moves[i]);
-        }
-    }
+// all the legal moves, in quiesce only the captures and promotions unless we are in check
+void generate_moves(MoveList& moves, const Board* board, bool quiesce) {
+    LegalMasks masks;
+    get_legal_masks(board, masks);
+    moves.set_end(generate_legal_captures(moves.end(), board, masks));
+    if(!quiesce || board->king_attackers)
+        moves.set_end(generate_legal_quiet(moves.end(), board, masks));
 }
 
 // returns a bitboard containing all the pieces which are attacking sq 
@@ -145,7 +135,7 @@ uint64_t get_between(int from_sq, int to_sq, const Board* board) {
 }
 
 // we assume that king is in check
-void generate_evasions(std::vector<Move>& moves, const Board* board) {
+void generate_evasions(MoveList& moves, const Board* board) {
     int from_sq, to_sq, king_pos = lsb(get_king_mask(board->side));
     assert(get_attackers(king_pos, board->xside, board) == board->king_attackers);
 
@@ -230,7 +220,7 @@ void generate_evasions(std::vector<Move>& moves, const Board* board) {
     }
 }
 
-void generate_captures(std::vector<Move>& moves, const Board* board) {
+void generate_captures(MoveList& moves, const Board* board) {
     uint64_t mask, attack_mask, pawn_mask = get_pawn_mask(board->side), xside_mask = get_side_mask(board->xside);
     int from_sq, to_sq;
 
@@ -403,7 +393,7 @@ void generate_captures(std::vector<Move>& moves, const Board* board) {
 }
 
 // we assume that the king isn't in check
-void generate_quiet(std::vector<Move>& moves, const Board* board) {
+void generate_quiet(MoveList& moves, const Board* board) {
     uint64_t mask, attack_mask, pawn_mask = get_pawn_mask(board->side);
     int from_sq, to_sq;
 
@@ -801,3 +791,406 @@ Move* new_generate_quiet(Move* moves, const Board* board) {
     return moves;
 }
 
+///////////////////////////////
+//                           //
+//   Legal move generation   //
+//                           //
+///////////////////////////////
+
+// a pinned piece can only move along the line through its king and the pinner
+static inline bool pin_allows(const LegalMasks& masks, int from_sq, int to_sq) {
+    return !(masks.pinned & mask_sq(from_sq)) || (line_through[masks.king_sq][from_sq] & mask_sq(to_sq));
+}
+
+// whether the king of the side to move would be attacked on sq, occ must not have the king
+static inline bool king_square_attacked(const Board* board, int sq, uint64_t occ) {
+    const bool xside = board->xside;
+    return (knight_attacks[sq] & get_knight_mask(xside))
+        || (king_attacks[sq] & get_king_mask(xside))
+        || (pawn_attacks[xside][sq] & get_pawn_mask(xside))
+        || (Bmagic(sq, occ) & (get_bishop_mask(xside) | get_queen_mask(xside)))
+        || (Rmagic(sq, occ) & (get_rook_mask(xside) | get_queen_mask(xside)));
+}
+
+// enpassant removes two pieces from the same row, so we just look at the king after the move
+static inline bool enpassant_legal(const Board* board, const LegalMasks& masks, int from_sq, int to_sq) {
+    const bool xside = board->xside;
+    const int captured_sq = board->side == WHITE ? to_sq - 8 : to_sq + 8;
+    const uint64_t occ = (board->occ_mask ^ mask_sq(from_sq) ^ mask_sq(captured_sq)) | mask_sq(to_sq);
+    return !(knight_attacks[masks.king_sq] & get_knight_mask(xside))
+        && !(pawn_attacks[xside][masks.king_sq] & get_pawn_mask(xside) & ~mask_sq(captured_sq))
+        && !(Bmagic(masks.king_sq, occ) & (get_bishop_mask(xside) | get_queen_mask(xside)))
+        && !(Rmagic(masks.king_sq, occ) & (get_rook_mask(xside) | get_queen_mask(xside)));
+}
+
+void get_legal_masks(const Board* board, LegalMasks& masks) {
+    const bool xside = board->xside;
+    const uint64_t side_mask = get_side_mask(board->side);
+    masks.king_sq = lsb(get_king_mask(board->side));
+    masks.pinned = 0;
+
+    // the sliders that would attack the king on an empty board pin the piece in between, if it's the only one
+    uint64_t snipers = (Rmagic(masks.king_sq, 0) & (get_rook_mask(xside) | get_queen_mask(xside)))
+                     | (Bmagic(masks.king_sq, 0) & (get_bishop_mask(xside) | get_queen_mask(xside)));
+    while(snipers) {
+        const uint64_t between = between_squares[masks.king_sq][pop_first_bit(snipers)] & board->occ_mask;
+        if(between && !(between & (between - 1)))
+            masks.pinned |= between & side_mask;
+    }
+
+    // we have to take the checker or block it, and only the king can move on a double check
+    if(!board->king_attackers)
+        masks.check_mask = ~uint64_t(0);
+    else if(!(board->king_attackers & (board->king_attackers - 1)))
+        masks.check_mask = board->king_attackers | between_squares[masks.king_sq][lsb(board->king_attackers)];
+    else
+        masks.check_mask = 0;
+}
+
+// for pseudo-legal moves, such as the killers once they are validated
+bool legal_move(const Board* board, const LegalMasks& masks, Move move) {
+    const int from_sq = get_from(move), to_sq = get_to(move);
+    if(from_sq == masks.king_sq) {
+        // the square the king crosses is checked by the validation
+        if(get_flag(move) == CASTLING_MOVE)
+            return !board->is_attacked(to_sq);
+        return !king_square_attacked(board, to_sq, board->occ_mask ^ mask_sq(from_sq));
+    }
+    if(get_flag(move) == ENPASSANT_MOVE)
+        return enpassant_legal(board, masks, from_sq, to_sq);
+    return (masks.check_mask & mask_sq(to_sq)) && pin_allows(masks, from_sq, to_sq);
+}
+
+// Same moves in the same order as new_generate_captures, without the ones that leave the king in check.
+Move* generate_legal_captures(Move* moves, const Board* board, const LegalMasks& masks) {
+    uint64_t mask, attack_mask, pawn_mask = get_pawn_mask(board->side), xside_mask = get_side_mask(board->xside);
+    const uint64_t targets = xside_mask & masks.check_mask;
+    int from_sq, to_sq;
+
+    if(board->side == WHITE) {
+        // enpassant capture
+        if(board->enpassant != NO_ENPASSANT) {
+            int enpassant_sq = 40 + int(board->enpassant);
+            assert(get_piece(enpassant_sq - 8) == BLACK_PAWN);
+            if(board->enpassant < 7 && get_piece(enpassant_sq - 7) == WHITE_PAWN
+            && enpassant_legal(board, masks, enpassant_sq - 7, enpassant_sq))
+                *moves++ = Move(enpassant_sq - 7, enpassant_sq, ENPASSANT_MOVE);
+            if(board->enpassant > 0 && get_piece(enpassant_sq - 9) == WHITE_PAWN
+            && enpassant_legal(board, masks, enpassant_sq - 9, enpassant_sq))
+                *moves++ = Move(enpassant_sq - 9, enpassant_sq, ENPASSANT_MOVE);
+        }
+
+        // promotion eating diagonally to the left (sq -> sq + 7)
+        mask = ((pawn_mask & ROW_6 & ~COL_0) << 7) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(!pin_allows(masks, to_sq - 7, to_sq))
+                continue;
+            *moves++ = Move(to_sq - 7, to_sq, QUEEN_PROMOTION);
+            *moves++ = Move(to_sq - 7, to_sq, KNIGHT_PROMOTION);
+            *moves++ = Move(to_sq - 7, to_sq, ROOK_PROMOTION);
+            *moves++ = Move(to_sq - 7, to_sq, BISHOP_PROMOTION);
+        }
+
+        // promotion eating diagonally to the right (sq -> sq + 9)
+        mask = ((pawn_mask & ROW_6 & ~COL_7) << 9) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(!pin_allows(masks, to_sq - 9, to_sq))
+                continue;
+            *moves++ = Move(to_sq - 9, to_sq, QUEEN_PROMOTION);
+            *moves++ = Move(to_sq - 9, to_sq, KNIGHT_PROMOTION);
+            *moves++ = Move(to_sq - 9, to_sq, ROOK_PROMOTION);
+            *moves++ = Move(to_sq - 9, to_sq, BISHOP_PROMOTION);
+        }
+
+        // promotion front (sq -> sq + 8)
+        mask = ((pawn_mask & ROW_6) << 8) & ~board->occ_mask & masks.check_mask;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(!pin_allows(masks, to_sq - 8, to_sq))
+                continue;
+            *moves++ = Move(to_sq - 8, to_sq, QUEEN_PROMOTION);
+            *moves++ = Move(to_sq - 8, to_sq, KNIGHT_PROMOTION);
+            *moves++ = Move(to_sq - 8, to_sq, ROOK_PROMOTION);
+            *moves++ = Move(to_sq - 8, to_sq, BISHOP_PROMOTION);
+        }
+
+        // pawn capture to the left (sq -> sq + 7)
+        mask = ((pawn_mask & ~ROW_6 & ~COL_0) << 7) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(pin_allows(masks, to_sq - 7, to_sq))
+                *moves++ = Move(to_sq - 7, to_sq, CAPTURE_MOVE);
+        }
+
+        // pawn capture to the right (sq -> sq + 9)
+        mask = ((pawn_mask & ~ROW_6 & ~COL_7) << 9) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(pin_allows(masks, to_sq - 9, to_sq))
+                *moves++ = Move(to_sq - 9, to_sq, CAPTURE_MOVE);
+        }
+    } else {
+        // enpassant capture
+        if(board->enpassant != NO_ENPASSANT) {
+            int enpassant_sq = 16 + int(board->enpassant);
+            assert(get_piece(enpassant_sq + 8) == WHITE_PAWN);
+            if(board->enpassant < 7 && get_piece(enpassant_sq + 9) == BLACK_PAWN
+            && enpassant_legal(board, masks, enpassant_sq + 9, enpassant_sq))
+                *moves++ = Move(enpassant_sq + 9, enpassant_sq, ENPASSANT_MOVE);
+            if(board->enpassant > 0 && get_piece(enpassant_sq + 7) == BLACK_PAWN
+            && enpassant_legal(board, masks, enpassant_sq + 7, enpassant_sq))
+                *moves++ = Move(enpassant_sq + 7, enpassant_sq, ENPASSANT_MOVE);
+        }
+
+        // promotion eating diagonally to the left (sq -> sq - 9)
+        mask = ((pawn_mask & ROW_1 & ~COL_0) >> 9) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(!pin_allows(masks, to_sq + 9, to_sq))
+                continue;
+            *moves++ = Move(to_sq + 9, to_sq, QUEEN_PROMOTION);
+            *moves++ = Move(to_sq + 9, to_sq, KNIGHT_PROMOTION);
+            *moves++ = Move(to_sq + 9, to_sq, ROOK_PROMOTION);
+            *moves++ = Move(to_sq + 9, to_sq, BISHOP_PROMOTION);
+        }
+
+        // promotion eating diagonally to the right (sq -> sq - 7)
+        mask = ((pawn_mask & ROW_1 & ~COL_7) >> 7) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(!pin_allows(masks, to_sq + 7, to_sq))
+                continue;
+            *moves++ = Move(to_sq + 7, to_sq, QUEEN_PROMOTION);
+            *moves++ = Move(to_sq + 7, to_sq, KNIGHT_PROMOTION);
+            *moves++ = Move(to_sq + 7, to_sq, ROOK_PROMOTION);
+            *moves++ = Move(to_sq + 7, to_sq, BISHOP_PROMOTION);
+        }
+
+        // promotion front (sq -> sq - 8)
+        mask = ((pawn_mask & ROW_1) >> 8) & ~board->occ_mask & masks.check_mask;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(!pin_allows(masks, to_sq + 8, to_sq))
+                continue;
+            *moves++ = Move(to_sq + 8, to_sq, QUEEN_PROMOTION);
+            *moves++ = Move(to_sq + 8, to_sq, KNIGHT_PROMOTION);
+            *moves++ = Move(to_sq + 8, to_sq, ROOK_PROMOTION);
+            *moves++ = Move(to_sq + 8, to_sq, BISHOP_PROMOTION);
+        }
+
+        // pawn capture to the left (sq -> sq - 9)
+        mask = ((pawn_mask & ~ROW_1 & ~COL_0) >> 9) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(pin_allows(masks, to_sq + 9, to_sq))
+                *moves++ = Move(to_sq + 9, to_sq, CAPTURE_MOVE);
+        }
+
+        // pawn capture to the right (sq -> sq - 7)
+        mask = ((pawn_mask & ~ROW_1 & ~COL_7) >> 7) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(pin_allows(masks, to_sq + 7, to_sq))
+                *moves++ = Move(to_sq + 7, to_sq, CAPTURE_MOVE);
+        }
+    }
+
+    // king captures
+    attack_mask = king_attacks[masks.king_sq] & xside_mask;
+    while(attack_mask) {
+        to_sq = pop_first_bit(attack_mask);
+        if(!king_square_attacked(board, to_sq, board->occ_mask ^ mask_sq(masks.king_sq)))
+            *moves++ = Move(masks.king_sq, to_sq, CAPTURE_MOVE);
+    }
+
+    // a pinned knight can never move
+    mask = get_knight_mask(board->side) & ~masks.pinned;
+    while(mask) {
+        from_sq = pop_first_bit(mask);
+        attack_mask = knight_attacks[from_sq] & targets;
+        while(attack_mask) {
+            to_sq = pop_first_bit(attack_mask);
+            *moves++ = Move(from_sq, to_sq, CAPTURE_MOVE);
+        }
+    }
+
+    // bishop and queen captures
+    mask = get_bishop_mask(board->side) | get_queen_mask(board->side);
+    while(mask) {
+        from_sq = pop_first_bit(mask);
+        attack_mask = Bmagic(from_sq, board->occ_mask) & targets;
+        if(masks.pinned & mask_sq(from_sq))
+            attack_mask &= line_through[masks.king_sq][from_sq];
+        while(attack_mask) {
+            to_sq = pop_first_bit(attack_mask);
+            *moves++ = Move(from_sq, to_sq, CAPTURE_MOVE);
+        }
+    }
+
+    // rook and queen captures
+    mask = get_rook_mask(board->side) | get_queen_mask(board->side);
+    while(mask) {
+        from_sq = pop_first_bit(mask);
+        attack_mask = Rmagic(from_sq, board->occ_mask) & targets;
+        if(masks.pinned & mask_sq(from_sq))
+            attack_mask &= line_through[masks.king_sq][from_sq];
+        while(attack_mask) {
+            to_sq = pop_first_bit(attack_mask);
+            *moves++ = Move(from_sq, to_sq, CAPTURE_MOVE);
+        }
+    }
+
+    return moves;
+}
+
+// Same moves in the same order as new_generate_quiet, without the ones that leave the king in
+// check, and it also works when we are in check.
+Move* generate_legal_quiet(Move* moves, const Board* board, const LegalMasks& masks) {
+    uint64_t mask, attack_mask, pawn_mask = get_pawn_mask(board->side);
+    const uint64_t targets = ~board->occ_mask & masks.check_mask;
+    int from_sq, to_sq;
+
+    if(board->side == WHITE) {
+        // front only one square (no promotion) (sq -> sq + 8)
+        mask = ((pawn_mask & (~ROW_6)) << 8) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(pin_allows(masks, to_sq - 8, to_sq))
+                *moves++ = Move(to_sq - 8, to_sq, QUIET_MOVE);
+        }
+
+        // frontal two squares (sq -> sq + 16)
+        mask = ((pawn_mask & ROW_1) << 8) & (~board->occ_mask);
+        mask = ((mask & ROW_2) << 8) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(pin_allows(masks, to_sq - 16, to_sq))
+                *moves++ = Move(to_sq - 16, to_sq, QUIET_MOVE);
+        }
+    } else {
+        // front only one square (no promotion) (sq -> sq - 8)
+        mask = ((pawn_mask & (~ROW_1)) >> 8) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(pin_allows(masks, to_sq + 8, to_sq))
+                *moves++ = Move(to_sq + 8, to_sq, QUIET_MOVE);
+        }
+
+        // frontal two squares (sq -> sq - 16)
+        mask = ((pawn_mask & ROW_6) >> 8) & (~board->occ_mask);
+        mask = ((mask & ROW_5) >> 8) & targets;
+        while(mask) {
+            to_sq = pop_first_bit(mask);
+            if(pin_allows(masks, to_sq + 16, to_sq))
+                *moves++ = Move(to_sq + 16, to_sq, QUIET_MOVE);
+        }
+    }
+
+    // castling, the king can't be in check nor cross or land on an attacked square
+    if(board->side == WHITE && !board->king_attackers) {
+        if((board->castling_flag & 1)
+        && !(board->occ_mask & castling_mask[WHITE_QUEEN_SIDE])
+        && !board->is_attacked(D1) && !board->is_attacked(C1)) {
+            assert(board->piece_at[E1] == KING);
+            *moves++ = Move(E1, C1, CASTLING_MOVE);
+        }
+        if((board->castling_flag & 2)
+        && !(board->occ_mask & castling_mask[WHITE_KING_SIDE])
+        && !board->is_attacked(F1) && !board->is_attacked(G1)) {
+            assert(board->piece_at[E1] == KING);
+            *moves++ = Move(E1, G1, CASTLING_MOVE);
+        }
+    } else if(board->side == BLACK && !board->king_attackers) {
+        if((board->castling_flag & 4)
+        && !(board->occ_mask & castling_mask[BLACK_QUEEN_SIDE])
+        && !board->is_attacked(D8) && !board->is_attacked(C8)) {
+            assert(board->piece_at[E8] == KING);
+            *moves++ = Move(E8, C8, CASTLING_MOVE);
+        }
+        if((board->castling_flag & 8)
+        && !(board->occ_mask & castling_mask[BLACK_KING_SIDE])
+        && !board->is_attacked(F8) && !board->is_attacked(G8)) {
+            assert(board->piece_at[E8] == KING);
+            *moves++ = Move(E8, G8, CASTLING_MOVE);
+        }
+    }
+
+    // king
+    attack_mask = king_attacks[masks.king_sq] & (~board->occ_mask);
+    while(attack_mask) {
+        to_sq = pop_first_bit(attack_mask);
+        if(!king_square_attacked(board, to_sq, board->occ_mask ^ mask_sq(masks.king_sq)))
+            *moves++ = Move(masks.king_sq, to_sq, QUIET_MOVE);
+    }
+
+    // knight
+    mask = get_knight_mask(board->side) & ~masks.pinned;
+    while(mask) {
+        from_sq = pop_first_bit(mask);
+        attack_mask = knight_attacks[from_sq] & targets;
+        while(attack_mask) {
+            to_sq = pop_first_bit(attack_mask);
+            *moves++ = Move(from_sq, to_sq, QUIET_MOVE);
+        }
+    }
+
+    // bishop and queen
+    mask = get_bishop_mask(board->side) | get_queen_mask(board->side);
+    while(mask) {
+        from_sq = pop_first_bit(mask);
+        attack_mask = Bmagic(from_sq, board->occ_mask) & targets;
+        if(masks.pinned & mask_sq(from_sq))
+            attack_mask &= line_through[masks.king_sq][from_sq];
+        while(attack_mask) {
+            to_sq = pop_first_bit(attack_mask);
+            *moves++ = Move(from_sq, to_sq, QUIET_MOVE);
+        }
+    }
+
+    // rooks and queen
+    mask = get_rook_mask(board->side) | get_queen_mask(board->side);
+    while(mask) {
+        from_sq = pop_first_bit(mask);
+        attack_mask = Rmagic(from_sq, board->occ_mask) & targets;
+        if(masks.pinned & mask_sq(from_sq))
+            attack_mask &= line_through[masks.king_sq][from_sq];
+        while(attack_mask) {
+            to_sq = pop_first_bit(attack_mask);
+            *moves++ = Move(from_sq, to_sq, QUIET_MOVE);
+        }
+    }
+
+    return moves;
+}
+
+Move* generate_legal_moves(Move* moves, const Board* board) {
+    LegalMasks masks;
+    get_legal_masks(board, masks);
+    moves = generate_legal_captures(moves, board, masks);
+    return generate_legal_quiet(moves, board, masks);
+}
+
+// Counts the leaves of the tree. The moves of the last ply are legal, so they are counted without
+// making them.
+uint64_t perft(Board& board, int depth, PerftTable* table) {
+    uint64_t nodes;
+    if(depth > 1 && table && table->probe(board.key, depth, nodes))
+        return nodes;
+    MoveList moves;
+    moves.set_end(generate_legal_moves(moves.begin(), &board));
+    if(depth <= 1)
+        return depth == 1 ? moves.size() : 1;
+
+    nodes = 0;
+    UndoData undo_data = UndoData(board.king_attackers);
+    for(Move move : moves) {
+        board.new_make_move(move, undo_data);
+        nodes += perft(board, depth - 1, table);
+        board.new_take_back(undo_data);
+    }
+    if(table)
+        table->store(board.key, depth, nodes);
+    return nodes;
+}
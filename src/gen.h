@@ -1,15 +1,104 @@
 #pragma once
 
+#include <cassert>
+#include <vector>
 #include "defs.h"
 #include "board.h"
 
+// The moves of a position, on the stack so that generating them never allocates. The pickers
+// keep the score of each move at the same index.
+struct MoveList {
+    Move moves[MAX_MOVES];
+    int scores[MAX_MOVES];
+    int n_moves;
+
+    MoveList() : n_moves(0) {}
+    int size() const { return n_moves; }
+    bool empty() const { return n_moves == 0; }
+    void clear() { n_moves = 0; }
+    Move* begin() { return moves; }
+    Move* end() { return moves + n_moves; }
+    Move& operator[](int index) { return moves[index]; }
+    Move operator[](int index) const { return moves[index]; }
+
+    void push_back(Move move) {
+        assert(n_moves < MAX_MOVES);
+        moves[n_moves++] = move;
+    }
+
+    // for the generators that write through a pointer and return the new end
+    void set_end(Move* end) {
+        n_moves = end - moves;
+        assert(n_moves <= MAX_MOVES);
+    }
+
+    // the last move and its score take the place of the removed one
+    void remove(int index) {
+        assert(index < n_moves);
+        n_moves--;
+        moves[index] = moves[n_moves];
+        scores[index] = scores[n_moves];
+    }
+};
+
 uint64_t get_attackers(int, bool, const Board*);
 void get_attackers(int sq, bool attacker_side, const Board* board, uint64_t& bb);
-void generate_moves(std::vector<Move>&, const Board*, bool quiesce = false);
-void generate_evasions(std::vector<Move>&, const Board*);
-void generate_captures(std::vector<Move>&, const Board*);
-void generate_quiet(std::vector<Move>&, const Board*);
+void generate_moves(MoveList&, const Board*, bool quiesce = false);
+void generate_evasions(MoveList&, const Board*);
+void generate_captures(MoveList&, const Board*);
+void generate_quiet(MoveList&, const Board*);
 
 Move* new_generate_captures(Move* moves, const Board*);
 Move* new_new_generate_captures(Move* moves, const Board*, Move* move_p);
 Move* new_generate_quiet(Move* moves, const Board*);
+
+// What the legal generators need to know about the side to move, computed once per node: its
+// pinned pieces and the squares its other pieces can move to (all of them when it isn't in check,
+// the checker and the squares in between on a single check, none on a double check).
+struct LegalMasks {
+    int king_sq;
+    uint64_t pinned, check_mask;
+};
+
+void get_legal_masks(const Board*, LegalMasks&);
+bool legal_move(const Board*, const LegalMasks&, Move);
+Move* generate_legal_captures(Move* moves, const Board*, const LegalMasks&);
+Move* generate_legal_quiet(Move* moves, const Board*, const LegalMasks&);
+Move* generate_legal_moves(Move* moves, const Board*);
+// The leaf counts of the subtrees already counted, so that transpositions are counted once. Like
+// the tt it is shared by the perft threads without locks: an entry keeps its count and the key
+// xored with it, so an entry two threads wrote at the same time matches no key and is a miss.
+struct PerftTable {
+    struct Entry {
+        uint64_t check, nodes;
+    };
+    std::vector<Entry> entries;
+    uint64_t mask;
+
+    explicit PerftTable(int mb_size) {
+        uint64_t n_entries = 1;
+        while(2 * n_entries * sizeof(Entry) <= (uint64_t(mb_size) << 20))
+            n_entries *= 2;
+        entries.assign(n_entries, Entry{0, 0});
+        mask = n_entries - 1;
+    }
+
+    // the same position is a different entry at every depth
+    static uint64_t entry_key(uint64_t key, int depth) {
+        return key ^ (uint64_t(depth) * 0x9E3779B97F4A7C15ULL);
+    }
+
+    bool probe(uint64_t key, int depth, uint64_t& nodes) const {
+        key = entry_key(key, depth);
+        const Entry entry = entries[key & mask];
+        nodes = entry.nodes;
+        return (entry.check ^ entry.nodes) == key;
+    }
+
+    void store(uint64_t key, int depth, uint64_t nodes) {
+        key = entry_key(key, depth);
+        entries[key & mask] = Entry{key ^ nodes, nodes};
+    }
+};
+
+uint64_t perft(Board&, int depth, PerftTable* table = NULL);
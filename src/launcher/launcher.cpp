@@ -0,0 +1,43 @@
+// Runs the build of dratini for the best instruction set this cpu has. `make archs` builds the
+// engine once per instruction set, as dratini-<arch>, next to this launcher.
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+using std::cerr;
+using std::endl;
+
+struct Arch {
+    const char* name;
+    bool supported;
+};
+
+int main(int argc, char** argv) {
+    __builtin_cpu_init();
+    const bool popcnt = __builtin_cpu_supports("popcnt");
+    const bool bmi2 = popcnt && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2");
+    const bool avx2 = bmi2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    const bool avx512 = avx2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512vl");
+    // pext is microcoded before zen 3, the magics are faster there
+    const bool slow_pext = __builtin_cpu_is("amdfam15h") || __builtin_cpu_is("amdfam17h");
+
+    // from the best to the most portable, the first one that exists is run
+    const Arch archs[] = {
+        {"avx512", avx512},
+        {"avx2-magic", avx2 && slow_pext},
+        {"avx2", avx2},
+        {"bmi2", bmi2 && !slow_pext},
+        {"popcnt", popcnt},
+        {"generic", true}
+    };
+
+    const std::string launcher = argv[0];
+    for(const Arch& arch : archs) if(arch.supported) {
+        const std::string exe = launcher + "-" + arch.name;
+        argv[0] = (char*)exe.c_str();
+        execvp(exe.c_str(), argv); // only returns if it failed
+    }
+    cerr << "No dratini build found for this cpu, run `make archs`" << endl;
+    return 1;
+}
@@ -214,6 +214,11 @@ U64 magicmovesrdb[4900];
 #endif
 #endif
 
+#ifdef USE_PEXT
+unsigned int pextmoves_b_offset[64];
+unsigned int pextmoves_r_offset[64];
+#endif
+
 U64 initmagicmoves_occ(const int* squares, const int numSquares, const U64 linocc)
 {
     int i;
@@ -323,6 +328,9 @@ U64 initmagicmoves_Bmoves(const int square, const U64 occ)
 void initmagicmoves(void)
 {
     int i;
+#ifdef USE_PEXT
+    int prev_numsquares=0;
+#endif
 
     //for bitscans :
     //initmagicmoves_bitpos64_database[(x*C64(0x07EDD5E59A4E28C2))>>58]
@@ -397,10 +405,16 @@ void initmagicmoves(void)
             squares[numsquares++]=initmagicmoves_bitpos64_database[(bit*C64(0x07EDD5E59A4E28C2))>>58];
             temp^=bit;
         }
+#ifdef USE_PEXT
+        pextmoves_b_offset[i]=i ? pextmoves_b_offset[i-1]+(1<<prev_numsquares) : 0;
+        prev_numsquares=numsquares;
+#endif
         for(temp=0;temp<(((U64)(1))<<numsquares);temp++)
         {
             U64 tempocc=initmagicmoves_occ(squares,numsquares,temp);
-#ifndef PERFECT_MAGIC_HASH
+#if defined(USE_PEXT)
+            magicmovesbdb[pextmoves_b_offset[i]+_pext_u64(tempocc,magicmoves_b_mask[i])]=initmagicmoves_Bmoves(i,tempocc);
+#elif !defined(PERFECT_MAGIC_HASH)
             BmagicNOMASK2(i,tempocc)=initmagicmoves_Bmoves(i,tempocc);
 #else
             U64 moves=initmagicmoves_Bmoves(i,tempocc);
@@ -434,10 +448,16 @@ void initmagicmoves(void)
             squares[numsquares++]=initmagicmoves_bitpos64_database[(bit*C64(0x07EDD5E59A4E28C2))>>58];
             temp^=bit;
         }
+#ifdef USE_PEXT
+        pextmoves_r_offset[i]=i ? pextmoves_r_offset[i-1]+(1<<prev_numsquares) : 0;
+        prev_numsquares=numsquares;
+#endif
         for(temp=0;temp<(((U64)(1))<<numsquares);temp++)
         {
             U64 tempocc=initmagicmoves_occ(squares,numsquares,temp);
-#ifndef PERFECT_MAGIC_HASH
+#if defined(USE_PEXT)
+            magicmovesrdb[pextmoves_r_offset[i]+_pext_u64(tempocc,magicmoves_r_mask[i])]=initmagicmoves_Rmoves(i,tempocc);
+#elif !defined(PERFECT_MAGIC_HASH)
             RmagicNOMASK2(i,tempocc)=initmagicmoves_Rmoves(i,tempocc);
 #else
             U64 moves=initmagicmoves_Rmoves(i,tempocc);
@@ -88,6 +88,14 @@
 
 #define USE_INLINING /*the MMINLINE keyword is assumed to be available*/
 
+//With bmi2 the attacks are found with pext instead of the magic multiply and shift. The pext of the
+//occupancy under the mask is a dense index, so each square gets 2^bits entries of the minimized
+//databases, packed one after the other. Define NO_PEXT to keep the magics on a bmi2 build, pext
+//is microcoded and much slower than the magics on amd cpus before zen 3.
+#if defined(__BMI2__) && !defined(NO_PEXT)
+#define USE_PEXT
+#endif
+
 #ifndef __64_BIT_INTEGER_DEFINED__
 #define __64_BIT_INTEGER_DEFINED__
 #if defined(_MSC_VER) && _MSC_VER<1300
@@ -180,9 +188,23 @@ extern const U64* magicmoves_r_indices[64];
 	#endif
 #endif //PERFCT_MAGIC_HASH
 
+#ifdef USE_PEXT
+#if !defined(MINIMIZE_MAGIC) || !defined(USE_INLINING)
+#error magicmoves - USE_PEXT needs MINIMIZE_MAGIC and USE_INLINING
+#endif
+#include <immintrin.h>
+extern U64 magicmovesbdb[5248];
+extern U64 magicmovesrdb[102400];
+extern unsigned int pextmoves_b_offset[64];
+extern unsigned int pextmoves_r_offset[64];
+#endif
+
 #ifdef USE_INLINING
 static MMINLINE U64 Bmagic(const unsigned int square, const U64 occupancy)
 {
+#ifdef USE_PEXT
+    return magicmovesbdb[pextmoves_b_offset[square]+_pext_u64(occupancy,magicmoves_b_mask[square])];
+#else
 #ifndef PERFECT_MAGIC_HASH
 #ifdef MINIMIZE_MAGIC
     return *(magicmoves_b_indices[square]+(((occupancy&magicmoves_b_mask[square])*magicmoves_b_magics[square])>>magicmoves_b_shift[square]));
@@ -192,9 +214,13 @@ static MMINLINE U64 Bmagic(const unsigned int square, const U64 occupancy)
 #else
     return magicmovesbdb[magicmoves_b_indices[square][(((occupancy)&magicmoves_b_mask[square])*magicmoves_b_magics[square])>>MINIMAL_B_BITS_SHIFT(square)]];
 #endif
+#endif
 }
 static MMINLINE U64 Rmagic(const unsigned int square,const U64 occupancy)
 {
+#ifdef USE_PEXT
+    return magicmovesrdb[pextmoves_r_offset[square]+_pext_u64(occupancy,magicmoves_r_mask[square])];
+#else
 #ifndef PERFECT_MAGIC_HASH
 #ifdef MINIMIZE_MAGIC
     return *(magicmoves_r_indices[square]+(((occupancy&magicmoves_r_mask[square])*magicmoves_r_magics[square])>>magicmoves_r_shift[square]));
@@ -204,9 +230,13 @@ static MMINLINE U64 Rmagic(const unsigned int square,const U64 occupancy)
 #else
     return magicmovesrdb[magicmoves_r_indices[square][(((occupancy)&magicmoves_r_mask[square])*magicmoves_r_magics[square])>>MINIMAL_R_BITS_SHIFT(square)]];
 #endif
+#endif
 }
 static MMINLINE U64 BmagicNOMASK(const unsigned int square,const U64 occupancy)
 {
+#ifdef USE_PEXT
+    return magicmovesbdb[pextmoves_b_offset[square]+_pext_u64(occupancy,magicmoves_b_mask[square])];
+#else
 #ifndef PERFECT_MAGIC_HASH
 #ifdef MINIMIZE_MAGIC
     return *(magicmoves_b_indices[square]+(((occupancy)*magicmoves_b_magics[square])>>magicmoves_b_shift[square]));
@@ -216,9 +246,13 @@ static MMINLINE U64 BmagicNOMASK(const unsigned int square,const U64 occupancy)
 #else
     return magicmovesbdb[magicmoves_b_indices[square][((occupancy)*magicmoves_b_magics[square])>>MINIMAL_B_BITS_SHIFT(square)]];
 #endif
+#endif
 }
 static MMINLINE U64 RmagicNOMASK(const unsigned int square, const U64 occupancy)
 {
+#ifdef USE_PEXT
+    return magicmovesrdb[pextmoves_r_offset[square]+_pext_u64(occupancy,magicmoves_r_mask[square])];
+#else
 #ifndef PERFECT_MAGIC_HASH
 #ifdef MINIMIZE_MAGIC
     return *(magicmoves_r_indices[square]+(((occupancy)*magicmoves_r_magics[square])>>magicmoves_r_shift[square]));
@@ -228,6 +262,7 @@ static MMINLINE U64 RmagicNOMASK(const unsigned int square, const U64 occupancy)
 #else
     return magicmovesrdb[magicmoves_r_indices[square][((occupancy)*magicmoves_r_magics[square])>>MINIMAL_R_BITS_SHIFT(square)]];
 #endif
+#endif
 }
 
 static MMINLINE U64 Qmagic(const unsigned int square,const U64 occupancy)
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <vector>
+#include <thread>
+#include <algorithm>
 #include "defs.h"
 #include "search.h"
 #include "board.h"
@@ -15,9 +17,45 @@
 TranspositionTable tt;
 Engine engine;
 
-int main() {
-	bench();
-	// uci();
+int main(int argc, char** argv) {
+	// nnuebench [net]
+	if(argc > 1 && std::string(argv[1]) == "nnuebench") {
+		if(!nnue_init(argc > 2 ? argv[2] : NNUE_PATH))
+			return 1;
+		nnue_bench();
+		return 0;
+	}
+	// scorefens <fen file> <output file, - for stdout> [threads] [net]
+	if(argc > 3 && std::string(argv[1]) == "scorefens") {
+		if(!nnue_init(argc > 5 ? argv[5] : NNUE_PATH))
+			return 1;
+		int n_threads = argc > 4 ? atoi(argv[4]) : std::thread::hardware_concurrency();
+		score_fens(argv[2], argv[3], std::max(1, std::min(MAX_THREADS, n_threads)));
+		return 0;
+	}
+	// perft <depth> [divide] [threads <n>] [hash <mb>] [fen]
+	if(argc > 2 && std::string(argv[1]) == "perft") {
+		perft_command(std::vector<std::string>(argv + 2, argv + argc), Board());
+		return 0;
+	}
+	// converts a net to the format that is mapped and used in place
+	// convertnet <in> <out> [king buckets: 64, or 32, 16 or 8 to derive a compact net]
+	if(argc > 3 && std::string(argv[1]) == "convertnet") {
+		if(!nnue_convert(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 64)) {
+			cerr << "Error converting " << argv[2] << " to " << argv[3] << endl;
+			return 1;
+		}
+		return 0;
+	}
+	// bench [threads]
+	if(argc > 1 && std::string(argv[1]) == "bench") {
+		if(!nnue_init(NNUE_PATH))
+			return 1;
+		bench(std::max(1, std::min(MAX_THREADS, argc > 2 ? atoi(argv[2]) : 1)));
+		return 0;
+	}
+	// without a command we talk uci, which is how the guis start us
+	uci();
 	return 0;
 		
 	engine.reset();
@@ -485,8 +485,10 @@ bool Board::move_valid(const Move move) {
 	int to_sq = get_to(move);
 	int flag = get_flag(move);
 
+	// the move may come from a corrupted or colliding tt entry, so the flag can be anything
 	if(from_sq < 0 || from_sq >= 64
 	|| to_sq < 0 || to_sq >= 64
+	|| flag == NULL_MOVE || flag > QUEEN_PROMOTION
 	|| (flag == QUIET_MOVE && get_piece(to_sq) != EMPTY)
 	|| (flag == CAPTURE_MOVE && get_piece(to_sq) == EMPTY)) {
 		return false;
@@ -503,10 +505,16 @@ bool Board::move_valid(const Move move) {
 		// this is the only place were we return true before the end of the function
 		return castling_valid(move);
 	} else if(piece == WHITE_PAWN || piece == BLACK_PAWN) {
+		// a pawn reaching the last row must have a promotion flag
+		if((flag == QUIET_MOVE || flag == CAPTURE_MOVE) && (row(to_sq) == 0 || row(to_sq) == 7))
+			return false;
 		if(!check_pawn_move(move)) {
 			return false;
         }
 	} else {
+		// only pawns can eat enpassant or promote
+		if(flag != QUIET_MOVE && flag != CAPTURE_MOVE)
+			return false;
 		piece -= (side == BLACK ? 6 : 0);
 		switch(piece) {
 			case KING:
@@ -34,7 +34,7 @@ static inline bool move_is_diagonal(const Move move) {
 }
 
 Move MovePicker::get_random_move(const Board& board) {
-	std::vector<Move> moves; 
+	MoveList moves;
 
 	generate_moves(moves, &board);
 
@@ -220,11 +220,7 @@ int MovePicker::slow_see(const Move move, const bool root) {
 
 void MovePicker::delete_move(int index) {
 	assert(!move_stack.empty());
-	assert(scores.size() == move_stack.size());
-	move_stack[index] = move_stack[move_stack.size() - 1];
-	scores[index] = move_stack[scores.size() - 1];
-	move_stack.pop_back();
-	scores.pop_back();
+	move_stack.remove(index);
 }
 
 int MovePicker::get_best_index(bool no_min) const {
@@ -234,12 +230,10 @@ int MovePicker::get_best_index(bool no_min) const {
 
 	int best_index = (no_min ? 0 : -1), best_score = -1;
 
-	assert(scores.size() == move_stack.size());
-
-	for(int index = 0; index < (int)scores.size(); index++) {
-		if(scores[index] > best_score) {
+	for(int index = 0; index < move_stack.size(); index++) {
+		if(move_stack.scores[index] > best_score) {
 			best_index = index;	
-			best_score = scores[index];
+			best_score = move_stack.scores[index];
 		}
 	}
 
@@ -248,22 +242,18 @@ int MovePicker::get_best_index(bool no_min) const {
 
 void MovePicker::sort_captures() {
 	for(int i = 0; i < move_stack.size(); i++) {
-		scores.push_back(
+		move_stack.scores[i] =
             thread->capture_history[board->piece_at[get_from(move_stack[i])]][get_to(move_stack[i])][board->piece_at[get_to(move_stack[i])]]
-			+ 50000 + 50000 * (get_flag(move_stack[i]) == QUEEN_PROMOTION)
-		);
-		assert(scores[scores.size() - 1] > 0);
+			+ 50000 + 50000 * (get_flag(move_stack[i]) == QUEEN_PROMOTION);
+		assert(move_stack.scores[i] > 0);
 	}
-	assert(move_stack.size() == scores.size());
 } 
 
 void MovePicker::sort_quiet() {
 	for(int i = 0; i < move_stack.size(); i++) {
-		scores.push_back(
-            100000 + thread->quiet_history[board->side][get_from(move_stack[i])][get_to(move_stack[i])]
-		);
-	}	
-	assert(move_stack.size() == scores.size());
+		move_stack.scores[i] =
+            100000 + thread->quiet_history[board->side][get_from(move_stack[i])][get_to(move_stack[i])];
+	}
 }
 
 Move MovePicker::next_move() {
@@ -305,7 +295,7 @@ Move MovePicker::next_move() {
 				&& board->piece_at[get_from(move_stack[best_index])] < board->piece_at[get_from(move_stack[best_index])] 
 				&& true) { // fast_see(move_stack[best_index]) < 0) { 
 				// } else if(fast_see(move_stack[best_index]) <= 0) {
-					scores[best_index] = -1;
+					move_stack.scores[best_index] = -1;
 					best_index = get_best_index();
 				} else {
 					const Move move = move_stack[best_index];
@@ -313,7 +303,7 @@ Move MovePicker::next_move() {
 					return move;
 				}
 			}
-			assert(scores.empty() || scores[0] == -1);
+			assert(move_stack.empty() || move_stack.scores[0] == -1);
 			phase = FIRST_KILLER;
 		}
 
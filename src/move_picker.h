@@ -73,8 +73,7 @@ class MovePicker {
 		int phase;
 		bool captures_only;
 		Move tt_move; 
-		std::vector<Move> move_stack;
-		std::vector<int> scores;
+		MoveList move_stack;
 		Board* board;
 		Thread* thread;
 };
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "board.h"
 #include "gen.h"
 #include "nnue.h"
+#include "tt.h"
 
 static const int pst[6][64] = {
   { 0, 4, 8, 10, 10, 8, 4, 0, 4, 8, 12, 14, 14, 12, 8, 4, 8, 12, 16, 18, 18, 16, 12, 8, 10, 14, 18, 20, 20, 18, 14, 10, 10, 14, 18, 20, 20, 18, 14, 10, 8, 12, 16, 18, 18, 16, 12, 8, 4, 8, 12, 14, 14, 12, 8, 4, 0, 4, 8, 10, 10, 8, 4, 0 },
@@ -137,7 +138,8 @@ void Board::new_take_back(const UndoData& undo) {
 
 	king_attackers = undo.king_attackers;
 
-	acc_stack[acc_stack_size & 7].has_been_computed = false;
+	Accumulator* acc = &acc_stack[acc_stack_size & (ACC_STACK_SIZE - 1)];
+	acc->computed[WHITE] = acc->computed[BLACK] = false;
 	if(acc_stack_size)
 		acc_stack_size--;
 }
@@ -168,15 +170,16 @@ void Board::new_make_move(const Move move, UndoData& undo_data) {
 	castling_flag &= castling_bitmasks[from_sq] & castling_bitmasks[to_sq];
 	key ^= zobrist_castling[castling_flag];
 
-	DirtyPiece* dp = &dp_stack[acc_stack_size & 7];
-	dp->no_king = piece != KING;
+	DirtyPiece* dp = &dp_stack[acc_stack_size & (ACC_STACK_SIZE - 1)];
+	dp->king_moved[side] = piece == KING;
+	dp->king_moved[xside] = false;
 	dp->dirtyNum = 1;
 	dp->pc[0] = (int)side_piece;
 	dp->from[0] = (int)from_sq;
 	dp->to[0] = (int)to_sq;
 
 	// typedef struct DirtyPiece {
-	// bool no_king;
+	// bool king_moved[2];
 	// int dirtyNum;
 	// int pc[3];
 	// int from[3];
@@ -186,7 +189,7 @@ void Board::new_make_move(const Move move, UndoData& undo_data) {
 	switch(get_flag(move)) {
 		case NULL_MOVE:
 			dp->dirtyNum = 0;
-			dp->no_king = true;
+			dp->king_moved[side] = false;
 			break;
 		case QUIET_MOVE: {
 			assert(piece_at[to_sq] == EMPTY);
@@ -314,14 +317,16 @@ void Board::new_make_move(const Move move, UndoData& undo_data) {
 	xside = side;
 	side = !side;
 	key ^= zobrist_side[side] ^ zobrist_side[xside];
+	// the child is probed right after this, so we hide the memory latency behind the rest of the move
+	tt.prefetch(key);
 
     keys.push_back(key);
 
     king_attackers = get_attackers(lsb(bits[KING + (side ? 6 : 0)]), xside, this);
 
 	acc_stack_size++;
-	acc_stack[acc_stack_size & 7].has_been_computed = false;
-	assert(acc_stack_size < 64);
+	Accumulator* acc = &acc_stack[acc_stack_size & (ACC_STACK_SIZE - 1)];
+	acc->computed[WHITE] = acc->computed[BLACK] = false;
 }
 
 bool Board::new_fast_move_valid(const Move move) const {
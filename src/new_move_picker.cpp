@@ -11,27 +11,31 @@ NewMovePicker::NewMovePicker(Thread& _thread, Move _tt_move, bool _quiesce) {
     killer_1 = _thread.killers[_thread.ply][0];
     killer_2 = _thread.killers[_thread.ply][1];
     quiesce = _quiesce;
+    get_legal_masks(board, legal_masks);
     phase = 0;
-    move_p = moves;
-    moves_end = moves;
-    scores_end = scores;
+    move_p = moves_end = moves.begin();
+    scores_end = moves.scores;
     bad_captures_end = bad_captures;
 }
 
 Move NewMovePicker::next_move() {
     switch(phase) {
         case 0: {
-            if(tt_move != NULL_MOVE
-            && board->move_valid(tt_move)
+            if(tt_move != NULL_MOVE && !board->move_valid(tt_move)) {
+                // a different position with the same bucket and check bits
+                thread->tt_stats.collisions++;
+            } else if(tt_move != NULL_MOVE
             && !((get_flag(tt_move) == QUIET_MOVE || get_flag(tt_move) != CASTLING_MOVE) && quiesce)) {
                 phase = 1;
                 return tt_move;
             }
         }
         case 1: {
-            moves_end = move_p = moves;
+            moves.clear();
+            move_p = moves.begin();
             bad_captures_end = bad_captures;
-            moves_end = new_generate_captures(moves, board);
+            moves.set_end(generate_legal_captures(moves.begin(), board, legal_masks));
+            moves_end = moves.end();
             if(moves_end - move_p < 0) {
                 thread->board.print_board();
             }
@@ -60,7 +64,8 @@ Move NewMovePicker::next_move() {
             if(move != NULL_MOVE 
             && move != tt_move
             && get_flag(move) != CAPTURE_MOVE
-            && board->new_move_valid(move)) {
+            && board->new_move_valid(move)
+            && legal_move(board, legal_masks, move)) {
                 return move;
             } 
         }
@@ -70,14 +75,16 @@ Move NewMovePicker::next_move() {
             if(move != NULL_MOVE
             && move != tt_move
             && get_flag(move) != CAPTURE_MOVE
-            && board->new_move_valid(move)) {
+            && board->new_move_valid(move)
+            && legal_move(board, legal_masks, move)) {
                 return move;
             }
         }
         case 5: {
             assert(move_p == moves_end);
             Move* quiets_start = moves_end;
-            moves_end = new_generate_quiet(move_p, board);
+            moves.set_end(generate_legal_quiet(moves_end, board, legal_masks));
+            moves_end = moves.end();
             score_quiet(quiets_start);
             phase = 6;
         }
@@ -130,7 +137,7 @@ bool NewMovePicker::bad_capture(Move _move) const {
 }
 
 void NewMovePicker::score_captures() {
-    for(move_p_aux = moves; move_p_aux < moves_end; move_p_aux++)
+    for(move_p_aux = moves.begin(); move_p_aux < moves_end; move_p_aux++)
         *(scores_end++) = thread->capture_history[board->piece_at[get_from(*move_p_aux)]][get_to(*move_p_aux)][board->piece_at[get_to(*move_p_aux)]];
 }
 
@@ -2,6 +2,7 @@
 #include "defs.h"
 #include "board.h"
 #include "search.h"
+#include "gen.h"
 
 class NewMovePicker {
 public:
@@ -14,10 +15,12 @@ public:
 
     Thread *thread;
     Board* board;
+    LegalMasks legal_masks; // every move we return is legal
     Move tt_move, killer_1, killer_2;
-    Move move, moves[256], bad_captures[256];
+    MoveList moves;
+    Move move, bad_captures[MAX_MOVES];
     Move *move_p, *move_p_aux, *moves_end, *bad_captures_end;
-    int aux, phase, scores[256];
+    int aux, phase;
     int *score_p_aux, *scores_end;
     bool quiesce;
 };
\ No newline at end of file
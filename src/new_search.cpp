@@ -12,7 +12,7 @@ int quiesce(NewThread& thread, int ply, int alpha, int beta, std::vector<Move> p
 void new_think(Engine& engine) {
     NewThread thread = NewThread(engine.board);
     thread.clear_hist();
-    tt.tt_date = (tt.tt_date + 1) & 255;
+    tt.age();
     thread.abort_search = false;
     thread.start_time = GetMS();
 
@@ -27,11 +27,12 @@ void new_think(Engine& engine) {
         engine.score = score;
     }
     engine.nodes = thread.nodes;
+    tt.stats.add(thread.tt_stats);
     engine.search_time = GetMS() - thread.start_time;
 }
 
 int new_search(NewThread& thread, int ply, int alpha, int beta, int depth, std::vector<Move>& pv) {
-    int best, score, new_depth, bound;
+    int best, score, new_depth, bound, eval;
     Move move;
     std::vector<Move> new_pv;
     UndoData undo_data = UndoData(thread.board.king_attackers);
@@ -45,7 +46,7 @@ int new_search(NewThread& thread, int ply, int alpha, int beta, int depth, std::
     if(ply) pv.clear();
     if(thread.board.is_draw() && ply) return 0;
     move = NULL_MOVE;
-    if(ply && tt.retrieve(thread.board.key, move, score, bound, alpha, beta, depth, ply))
+    if(ply && tt.retrieve(thread.tt_stats, thread.board.key, move, score, bound, eval, alpha, beta, depth, ply))
         return score;
     if(ply >= 31)
         return evaluate(thread.board);
@@ -57,7 +58,7 @@ int new_search(NewThread& thread, int ply, int alpha, int beta, int depth, std::
         thread.board.take_back(undo_data);
         if(thread.abort_search) return 0;
         if(score >= beta) { 
-            tt.save(thread.board.key, NULL_MOVE, score, LOWER_BOUND, depth, ply);
+            tt.save(thread.tt_stats, thread.board.key, NULL_MOVE, score, LOWER_BOUND, depth, ply);
             return score;
         }
     }
@@ -79,7 +80,7 @@ int new_search(NewThread& thread, int ply, int alpha, int beta, int depth, std::
         if(thread.abort_search) return 0;
         if(score >= beta) {
             thread.hist(move, depth, ply);
-            tt.save(thread.board.key, move, score, LOWER_BOUND, depth, ply);
+            tt.save(thread.tt_stats, thread.board.key, move, score, LOWER_BOUND, depth, ply);
             return score;
         }
         if(score > best) {
@@ -105,9 +106,9 @@ int new_search(NewThread& thread, int ply, int alpha, int beta, int depth, std::
         return thread.board.king_attackers ? (-CHECKMATE + ply) : 0;
     if(!pv.empty()) {
         thread.hist(pv[0], depth, ply);
-        tt.save(thread.board.key, pv[0], best, EXACT_BOUND, depth, ply);
+        tt.save(thread.tt_stats, thread.board.key, pv[0], best, EXACT_BOUND, depth, ply);
     } else
-        tt.save(thread.board.key, NULL_MOVE, best, UPPER_BOUND, depth, ply);
+        tt.save(thread.tt_stats, thread.board.key, NULL_MOVE, best, UPPER_BOUND, depth, ply);
     return best;
 }
 
@@ -3,6 +3,7 @@
 #include <sys/time.h>
 #include "defs.h"
 #include "engine.h"
+#include "tt.h"
 #include "magicmoves.h"
 #include "bitboard.h"
 #include "board.h"
@@ -45,6 +46,7 @@ struct NewThread {
     int nodes, start_time, move_time, root_depth;
     bool abort_search;
     Board board;
+    TTStats tt_stats;
 
     NewThread(Board& _board) {
         board = _board;
@@ -83,8 +85,7 @@ struct NewSearchMovePicker {
     NewThread *thread;
     Board* board;
     Move tt_move, killer_1, killer_2;
-    std::vector<Move> moves, bad_captures;
-    std::vector<int> scores;
+    MoveList moves, bad_captures;
     int next, badp, phase;
     bool quiesce;
 
@@ -110,7 +111,6 @@ struct NewSearchMovePicker {
                     return move;
                 }
             case 1:
-                moves.reserve(20);
                 generate_captures(moves, board);
                 score_captures();
                 next = 0; 
@@ -151,7 +151,6 @@ struct NewSearchMovePicker {
                     return move;
                 }
             case 5:
-                moves.reserve(20);
                 assert(next == moves.size());
                 generate_quiet(moves, board);
                 score_quiet(next);
@@ -168,7 +167,7 @@ struct NewSearchMovePicker {
                 } 
                 phase = 7;
             case 7: // bad captures
-                while(badp < (int)bad_captures.size()) {
+                while(badp < bad_captures.size()) {
                     return bad_captures[badp++];
                 }
                 break;
@@ -178,8 +177,8 @@ struct NewSearchMovePicker {
 
     Move select_best() {
         for(int i = moves.size() - 1; i > next; i--) {
-            if(scores[i] > scores[i - 1]) {
-                std::swap(scores[i - 1], scores[i]);
+            if(moves.scores[i] > moves.scores[i - 1]) {
+                std::swap(moves.scores[i - 1], moves.scores[i]);
                 std::swap(moves[i - 1], moves[i]);
             }
         }
@@ -200,18 +199,15 @@ struct NewSearchMovePicker {
     void score_captures() {
         for(int i = 0; i < moves.size(); i++) {
             // scores.push_back(thread->capture_history[board->piece_at[get_from(moves[i])]][get_to(moves[i])][board->piece_at[get_to(moves[i])]]);
-            scores.push_back(mvvlva(moves[i]));
+            moves.scores[i] = mvvlva(moves[i]);
         }
-        assert(scores.size() == moves.size());
     }
 
     void score_quiet(int quiet_start) {
         for(int i = quiet_start; i < moves.size(); i++) {
-            scores.push_back(
-                thread->history[board->piece_at[get_from(moves[i])] + (board->color_at[get_from(moves[i])] == WHITE ? 0 : 6)][get_to(moves[i])]
-            );
+            moves.scores[i] =
+                thread->history[board->piece_at[get_from(moves[i])] + (board->color_at[get_from(moves[i])] == WHITE ? 0 : 6)][get_to(moves[i])];
         }
-        assert(scores.size() == moves.size());
     }
 
     int mvvlva(const Move move) {
@@ -1,4 +1,9 @@
 #include <iostream>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
 #include <sys/stat.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -7,6 +12,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <cinttypes>
 #include "defs.h"
 #include "board.h"
 #include "nnue.h"
@@ -17,21 +23,34 @@ typedef uint64_t mask2_t;
 typedef int8_t weight_t;
 
 #define INCREMENTAL_NNUE
-#define USE_AVX2
 
-#if defined(USE_AVX2)
+// The simd kernels are compiled for their own instruction set with target attributes and we pick
+// them at startup from what the cpu supports, so the same binary runs on every machine.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define USE_SIMD_DISPATCH
 #include <immintrin.h>
-#define SIMD_WIDTH 256
-typedef __m256i vec16_t;
-typedef __m256i vec8_t;
-#define vec_add_16(a,b) _mm256_add_epi16(a,b)
-#define vec_sub_16(a,b) _mm256_sub_epi16(a,b)
-#define vec_packs(a,b) _mm256_packs_epi16(a,b)
-#define vec_mask_pos(a) _mm256_movemask_epi8(_mm256_cmpgt_epi8(a,_mm256_setzero_si256()))
-#define NUM_REGS 16
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define AVX512_TARGET __attribute__((target("avx2,avx512f,avx512bw")))
+#define VNNI_TARGET __attribute__((target("avx2,avx512f,avx512bw,avx512vl,avx512vnni")))
 #endif
 
-static int16_t ft_weights alignas(64) [256 * 41024];
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_AVX512_VNNI
+};
+
+static const char* simd_level_names[] = { "scalar", "avx2", "avx512", "avx512 vnni" };
+static int simd_level = SIMD_SCALAR;
+
+// The feature transformer weights are most of the net. They live either in our own buffer, filled
+// from a net in the original format, or in place in a mapping of a converted net, whose pages the
+// page cache shares between every engine process using it.
+static const int16_t* ft_weights = NULL;
+static int16_t* ft_weights_buffer = NULL;
+static void* mapped_net = NULL;
+static size_t mapped_net_size = 0;
 static weight_t hidden_1_weights alignas(64) [2 * 256 * 32];
 static weight_t hidden_2_weights alignas(64) [32 * 32];
 static clipped_t output_weights alignas(64) [1 * 32];
@@ -41,6 +60,16 @@ static int32_t hidden_1_biases alignas(64) [32];
 static int32_t hidden_2_biases alignas(64) [32];
 static int32_t output_biases[1];
 
+// the positions of the set bits of every byte, to list the nonzero inputs of the first layer
+static uint16_t bit_positions alignas(16) [256][8];
+
+// the hidden layers as they come in the net, each simd level wants them in its own order
+static weight_t net_hidden_1_weights[32][512];
+static weight_t net_hidden_2_weights[32][32];
+static int32_t net_hidden_1_biases[32];
+static int32_t net_hidden_2_biases[32];
+
+
 enum ACC_INDEXES {
     INDEX_WHITE_PAWN = 1,
     INDEX_BLACK_PAWN = 65,
@@ -70,8 +99,9 @@ static const int NetworkStart = TransformerStart + 4 + 2 * 256 + 2 * 256 * 64 *
 static const int SHIFT = 6;
 static const int FV_SCALE = 16;
 static const int kHalfDimensions = 256;
-static const int FtInDims = INDEX_END * 64;
+static const int FtInDims = INDEX_END * 64; // of a HalfKP net, a compact one has fewer king buckets
 static bool nnue_initialized = false;
+NnueStats nnue_stats;
 
 struct IndexList {
     int values[2][32];
@@ -97,8 +127,30 @@ inline int orient(int sq, bool side) {
     return side ? (sq ^ 63) : sq;
 }
 
+// The feature transformer has a block of weights for every king bucket. HalfKP nets have a bucket
+// for each king square. Compact nets share buckets between squares and mirror the board so that
+// their king is always on the queen side, so their weights are small enough to stay in the cache.
+static uint8_t king_buckets[64];
+static bool mirrored_buckets = false;
+static int n_king_buckets = 64;
+
+// ksq is already oriented
 inline int make_acc_index(int pc, int sq, int ksq, bool perspective) {
-    return 256 * (orient(sq, perspective) + pieceToIndex[perspective][pc] + ksq * INDEX_END); // * kHalfDimensions; 
+    sq = orient(sq, perspective);
+    if(mirrored_buckets && (ksq & 4))
+        sq ^= 7;
+    return 256 * (sq + pieceToIndex[perspective][pc] + king_buckets[ksq] * INDEX_END); // * kHalfDimensions; 
+}
+
+// a king move only changes the features of its side if it goes to another bucket or half of the board
+inline bool king_features_change(int from, int to, bool perspective) {
+    from = orient(from, perspective);
+    to = orient(to, perspective);
+    return king_buckets[from] != king_buckets[to] || (mirrored_buckets && ((from ^ to) & 4));
+}
+
+inline size_t ft_weights_size() {
+    return size_t(kHalfDimensions) * INDEX_END * n_king_buckets;
 }
 
 void append_active_indices(IndexList* index_list, Board* board) {
@@ -110,67 +162,164 @@ void append_active_indices(IndexList* index_list, Board* board) {
     }
 } 
 
-void append_changed_indices(IndexList* added_indices, IndexList* removed_indices, Board* board, DirtyPiece* dp) {
-    int w_ksq = lsb(board->bits[WHITE_KING]);
-    int b_ksq = orient(lsb(board->bits[BLACK_KING]), BLACK);
+// the number of features a move adds and removes, kings aren't features
+int changed_features(DirtyPiece* dp) {
+    int n_changes = 0;
+    for(int i = 0; i < dp->dirtyNum; i++) if(dp->pc[i] != WHITE_KING && dp->pc[i] != BLACK_KING)
+        n_changes += (dp->from[i] != NO_SQ) + (dp->to[i] != NO_SQ);
+    return n_changes;
+}
+
+void append_changed_indices(IndexList* added_indices, IndexList* removed_indices, Board* board, DirtyPiece* dp, int perspective) {
+    const int ksq = orient(lsb(board->bits[make_piece(KING, perspective)]), perspective);
     for(int i = 0; i < dp->dirtyNum; i++) if(dp->pc[i] != WHITE_KING && dp->pc[i] != BLACK_KING) {
-        if(dp->from[i] != NO_SQ) {
-            removed_indices->values[WHITE][removed_indices->size] = make_acc_index(dp->pc[i], dp->from[i], w_ksq, WHITE);
-            removed_indices->values[BLACK][removed_indices->size++] = make_acc_index(dp->pc[i], dp->from[i], b_ksq, BLACK);
-        }
-        if(dp->to[i] != NO_SQ) {
-            added_indices->values[WHITE][added_indices->size] = make_acc_index(dp->pc[i], dp->to[i], w_ksq, WHITE);
-            added_indices->values[BLACK][added_indices->size++] = make_acc_index(dp->pc[i], dp->to[i], b_ksq, BLACK);
-        }
+        if(dp->from[i] != NO_SQ)
+            removed_indices->values[perspective][removed_indices->size++] = make_acc_index(dp->pc[i], dp->from[i], ksq, perspective);
+        if(dp->to[i] != NO_SQ)
+            added_indices->values[perspective][added_indices->size++] = make_acc_index(dp->pc[i], dp->to[i], ksq, perspective);
     }
 }
 
-void compute_acc(Accumulator* acc, IndexList* indices) {
-// #if defined(AVX2)
-//     to be implemented...
-// #else
-    memcpy(acc->accumulation[WHITE], ft_biases, 256 * sizeof(int16_t));
-    memcpy(acc->accumulation[BLACK], ft_biases, 256 * sizeof(int16_t));
-
+static void apply_features_scalar(int16_t* acc, const int16_t* start, const int* removed, unsigned n_removed,
+                                  const int* added, unsigned n_added) {
     unsigned i, j;
 
-    for(i = 0; i < indices->size; i++) {
-        for(j = 0; j < kHalfDimensions; j++) {
-            acc->accumulation[WHITE][j] += ft_weights[indices->values[WHITE][i] + j]; 
-            acc->accumulation[BLACK][j] += ft_weights[indices->values[BLACK][i] + j]; 
-        }
+    if(acc != start)
+        memcpy(acc, start, kHalfDimensions * sizeof(int16_t));
+
+    for(i = 0; i < n_removed; i++) {
+        for(j = 0; j < kHalfDimensions; j++)
+            acc[j] -= ft_weights[removed[i] + j];
     }
 
-    acc->has_been_computed = true;
-// #endif
+    for(i = 0; i < n_added; i++) {
+        for(j = 0; j < kHalfDimensions; j++)
+            acc[j] += ft_weights[added[i] + j];
+    }
 }
 
-void update_acc(Accumulator* acc, Accumulator* prev_acc, IndexList* added_indices, IndexList* removed_indices) {
-// #ifdef USE_AVX2
-//     to be implemented...
-// #else
-    assert(prev_acc->has_been_computed);
+#ifdef USE_SIMD_DISPATCH
+// The whole 256-wide half accumulator is kept in registers (16 ymm or 8 zmm) while we go through all
+// the features, so each weight row is read once straight from memory and the result is stored once.
+// The register loops have to be unrolled, otherwise gcc keeps the array on the stack.
+AVX2_TARGET static void apply_features_avx2(int16_t* acc, const int16_t* start, const int* removed, unsigned n_removed,
+                                            const int* added, unsigned n_added) {
+    const unsigned num_regs = kHalfDimensions / 16;
+    __m256i regs[num_regs];
+    const __m256i* column;
+    unsigned i, j;
+
+    #pragma GCC unroll 16
+    for(j = 0; j < num_regs; j++)
+        regs[j] = ((const __m256i*)start)[j];
+
+    for(i = 0; i < n_removed; i++) {
+        column = (const __m256i*)&ft_weights[removed[i]];
+        #pragma GCC unroll 16
+        for(j = 0; j < num_regs; j++)
+            regs[j] = _mm256_sub_epi16(regs[j], column[j]);
+    }
+
+    for(i = 0; i < n_added; i++) {
+        column = (const __m256i*)&ft_weights[added[i]];
+        #pragma GCC unroll 16
+        for(j = 0; j < num_regs; j++)
+            regs[j] = _mm256_add_epi16(regs[j], column[j]);
+    }
 
-    memcpy(acc, prev_acc, sizeof(Accumulator));
+    #pragma GCC unroll 16
+    for(j = 0; j < num_regs; j++)
+        ((__m256i*)acc)[j] = regs[j];
+}
 
+AVX512_TARGET static void apply_features_avx512(int16_t* acc, const int16_t* start, const int* removed, unsigned n_removed,
+                                                const int* added, unsigned n_added) {
+    const unsigned num_regs = kHalfDimensions / 32;
+    __m512i regs[num_regs];
+    const __m512i* column;
     unsigned i, j;
 
-    for(i = 0; i < removed_indices->size; i++) {
-        for(j = 0; j < kHalfDimensions; j++) {
-            acc->accumulation[WHITE][j] -= ft_weights[removed_indices->values[WHITE][i] + j]; 
-            acc->accumulation[BLACK][j] -= ft_weights[removed_indices->values[BLACK][i] + j]; 
-        }
+    #pragma GCC unroll 16
+    for(j = 0; j < num_regs; j++)
+        regs[j] = ((const __m512i*)start)[j];
+
+    for(i = 0; i < n_removed; i++) {
+        column = (const __m512i*)&ft_weights[removed[i]];
+        #pragma GCC unroll 16
+        for(j = 0; j < num_regs; j++)
+            regs[j] = _mm512_sub_epi16(regs[j], column[j]);
     }
 
-    for(i = 0; i < added_indices->size; i++) {
-        for(j = 0; j < kHalfDimensions; j++) {
-            acc->accumulation[WHITE][j] += ft_weights[added_indices->values[WHITE][i] + j]; 
-            acc->accumulation[BLACK][j] += ft_weights[added_indices->values[BLACK][i] + j]; 
-        }
+    for(i = 0; i < n_added; i++) {
+        column = (const __m512i*)&ft_weights[added[i]];
+        #pragma GCC unroll 16
+        for(j = 0; j < num_regs; j++)
+            regs[j] = _mm512_add_epi16(regs[j], column[j]);
+    }
+
+    #pragma GCC unroll 16
+    for(j = 0; j < num_regs; j++)
+        ((__m512i*)acc)[j] = regs[j];
+}
+#endif
+
+static void apply_features(int16_t* acc, const int16_t* start, const int* removed, unsigned n_removed,
+                           const int* added, unsigned n_added) {
+    switch(simd_level) {
+#ifdef USE_SIMD_DISPATCH
+        case SIMD_AVX512: case SIMD_AVX512_VNNI:
+            apply_features_avx512(acc, start, removed, n_removed, added, n_added);
+            break;
+        case SIMD_AVX2:
+            apply_features_avx2(acc, start, removed, n_removed, added, n_added);
+            break;
+#endif
+        default:
+            apply_features_scalar(acc, start, removed, n_removed, added, n_added);
+    }
+}
+
+void compute_acc(Accumulator* acc, IndexList* indices, int perspective) {
+    apply_features(acc->accumulation[perspective], ft_biases, NULL, 0,
+                   indices->values[perspective], indices->size);
+    acc->computed[perspective] = true;
+}
+
+void update_acc(Accumulator* acc, Accumulator* prev_acc, IndexList* added_indices, IndexList* removed_indices, int perspective) {
+    assert(prev_acc->computed[perspective]);
+    apply_features(acc->accumulation[perspective], prev_acc->accumulation[perspective],
+                   removed_indices->values[perspective], removed_indices->size,
+                   added_indices->values[perspective], added_indices->size);
+    acc->computed[perspective] = true;
+}
+
+// refreshes a perspective from the cached accumulator of its king square
+void refresh_acc(Accumulator* acc, Board* board, AccumulatorCache* cache, int perspective) {
+    int added[32], removed[32];
+    unsigned n_added = 0, n_removed = 0;
+    uint64_t to_add, to_remove;
+
+    const int ksq = orient(lsb(board->bits[make_piece(KING, perspective)]), perspective);
+    AccumulatorCacheEntry* entry = &cache->entries[perspective][ksq];
+    if(!entry->valid) {
+        memcpy(entry->accumulation, ft_biases, sizeof(entry->accumulation));
+        memset(entry->bits, 0, sizeof(entry->bits));
+        entry->valid = true;
+    }
+
+    for(int pc = WHITE_PAWN; pc <= BLACK_KING; pc++) if(pc != WHITE_KING && pc != BLACK_KING) {
+        to_add = board->bits[pc] & ~entry->bits[pc];
+        to_remove = entry->bits[pc] & ~board->bits[pc];
+        for(; to_add; to_add &= to_add - 1)
+            added[n_added++] = make_acc_index(pc, lsb(to_add), ksq, perspective);
+        for(; to_remove; to_remove &= to_remove - 1)
+            removed[n_removed++] = make_acc_index(pc, lsb(to_remove), ksq, perspective);
+        entry->bits[pc] = board->bits[pc];
     }
 
-    assert(acc->has_been_computed);
-// #endif
+    apply_features(entry->accumulation, entry->accumulation, removed, n_removed, added, n_added);
+    memcpy(acc->accumulation[perspective], entry->accumulation, sizeof(entry->accumulation));
+    acc->computed[perspective] = true;
 }
 
 static bool verify_net(const void *eval_data, size_t size) {
@@ -188,7 +337,8 @@ static bool verify_net(const void *eval_data, size_t size) {
   return true;
 }
 
-#ifdef USE_AVX2
+
+#ifdef USE_SIMD_DISPATCH
 static void permute_biases(int32_t *biases) {
   __m128i *b = (__m128i *)biases;
   __m128i tmp[8];
@@ -205,47 +355,198 @@ static void permute_biases(int32_t *biases) {
 #endif
 
 inline unsigned wt_idx(unsigned r, unsigned c, unsigned dims) {
-    (void)dims;
-#ifdef USE_AVX2
-  if (dims > 32) {
+  // the simd transforms interleave blocks of 8 inputs of the first layer
+  if (simd_level != SIMD_SCALAR && dims > 32) {
     unsigned b = c & 0x18;
     b = (b << 1) | (b >> 1);
     c = (c & ~0x18) | (b & 0x18);
   }
-#endif
+  // the sparse first layer and vpdpbusd want the weights of 4 consecutive inputs of every output together
+  if (simd_level == SIMD_AVX512_VNNI || (simd_level != SIMD_SCALAR && dims > 32))
+    return (c / 4) * 128 + r * 4 + (c % 4);
   return c * 32 + r;
 }
 
+// lays out the hidden layers for the kernels of the current simd level
+static void arrange_weights() {
+    int i, j;
+
+    memcpy(hidden_1_biases, net_hidden_1_biases, sizeof(hidden_1_biases));
+    memcpy(hidden_2_biases, net_hidden_2_biases, sizeof(hidden_2_biases));
+    for(j = 0; j < 32; j++)
+        for(i = 0; i < 512; i++)
+            hidden_1_weights[wt_idx(j, i, 512)] = net_hidden_1_weights[j][i];
+    for(j = 0; j < 32; j++)
+        for(i = 0; i < 32; i++)
+            hidden_2_weights[wt_idx(j, i, 32)] = net_hidden_2_weights[j][i];
+
+#ifdef USE_SIMD_DISPATCH
+    // the avx2 kernel of the second layer accumulates the outputs in an interleaved order
+    if(simd_level == SIMD_AVX2 || simd_level == SIMD_AVX512)
+        permute_biases(hidden_2_biases);
+
+    for(int byte = 0; byte < 256; byte++) {
+        int n_bits = 0;
+        for(int bit = 0; bit < 8; bit++) if(byte & (1 << bit))
+            bit_positions[byte][n_bits++] = bit;
+    }
+#endif
+}
+
+static void unmap_net() {
+    if(mapped_net)
+        munmap(mapped_net, mapped_net_size);
+    mapped_net = NULL;
+    mapped_net_size = 0;
+}
+
 void read_net(const void* eval_data) {
     const char* d = (const char*)eval_data + TransformerStart + 4;
     int i, j;
 
+    if(!ft_weights_buffer)
+        ft_weights_buffer = (int16_t*)aligned_alloc(64, kHalfDimensions * FtInDims * sizeof(int16_t));
     for(i = 0; i < kHalfDimensions; i++, d += 2)
         ft_biases[i] = readu_le_u16(d);
     for(i = 0; i < kHalfDimensions * FtInDims; i++, d += 2)
-        ft_weights[i] = readu_le_u16(d);
+        ft_weights_buffer[i] = readu_le_u16(d);
+    ft_weights = ft_weights_buffer;
+    unmap_net();
+    for(i = 0; i < 64; i++)
+        king_buckets[i] = i;
+    mirrored_buckets = false;
+    n_king_buckets = 64;
 
     d += 4; // very important!
 
     for(i = 0; i < 32; i++, d += 4)
-        hidden_1_biases[i] = readu_le_u32(d);
+        net_hidden_1_biases[i] = readu_le_u32(d);
     for(j = 0; j < 32; j++)
         for(i = 0; i < 512; i++, d += 1)
-            hidden_1_weights[wt_idx(j, i, 512)] = *d;
+            net_hidden_1_weights[j][i] = *d;
     for(i = 0; i < 32; i++, d += 4)
-        hidden_2_biases[i] = readu_le_u32(d);
+        net_hidden_2_biases[i] = readu_le_u32(d);
     for(j = 0; j < 32; j++)
         for(i = 0; i < 32; i++, d += 1)
-            hidden_2_weights[wt_idx(j, i, 32)] = *d;
+            net_hidden_2_weights[j][i] = *d;
     for(i = 0; i < 1; i++, d += 4)
         output_biases[i] = readu_le_u32(d);
     for(i = 0; i < 32; i++, d += 1)
         output_weights[i] = readu_le_u8(d);
 
-#ifdef USE_AVX2
-    permute_biases(hidden_1_biases);
-    permute_biases(hidden_2_biases);
+    arrange_weights();
+}
+
+// A converted net is stored the way we keep it in memory: a cache line long header, the king
+// bucket of every square, then the feature transformer biases and weights, 64-byte aligned for the
+// simd loads, then the hidden layers in their natural order, which every simd level rearranges
+// for itself.
+static const char converted_net_magic[8] = "DRANNUE";
+static const uint32_t converted_net_version = 2;
+
+struct ConvertedNetHeader {
+    char magic[8];
+    uint32_t version, half_dimensions, ft_in_dims, hidden_dimensions;
+    uint32_t n_king_buckets, mirrored_buckets;
+    uint8_t padding[32];
+};
+static_assert(sizeof(ConvertedNetHeader) == 64, "The header should fill a cache line");
+
+static size_t converted_net_size(int n_buckets) {
+    return sizeof(ConvertedNetHeader) + sizeof(king_buckets) + sizeof(ft_biases)
+        + size_t(kHalfDimensions) * INDEX_END * n_buckets * sizeof(int16_t)
+        + sizeof(net_hidden_1_biases) + sizeof(net_hidden_1_weights) + sizeof(net_hidden_2_biases)
+        + sizeof(net_hidden_2_weights) + sizeof(output_biases) + sizeof(output_weights);
+}
+
+static bool verify_converted_net(const void* eval_data, size_t size) {
+    const ConvertedNetHeader* header = (const ConvertedNetHeader*)eval_data;
+    const uint8_t* buckets = (const uint8_t*)eval_data + sizeof(ConvertedNetHeader);
+    // the version also tells us whether the file was written with our endianness
+    if(size < sizeof(ConvertedNetHeader) + sizeof(king_buckets)
+    || memcmp(header->magic, converted_net_magic, sizeof(header->magic))
+    || header->version != converted_net_version
+    || header->n_king_buckets < 1 || header->n_king_buckets > 64
+    || size != converted_net_size(header->n_king_buckets)
+    || header->half_dimensions != kHalfDimensions
+    || header->ft_in_dims != INDEX_END * header->n_king_buckets
+    || header->hidden_dimensions != 32)
+        return false;
+    for(int sq = 0; sq < 64; sq++) {
+        if(buckets[sq] >= header->n_king_buckets
+        || (header->mirrored_buckets && buckets[sq] != buckets[sq ^ 7]))
+            return false;
+    }
+    return true;
+}
+
+// the feature transformer weights are used in place, the rest is small and copied
+static void read_converted_net(const void* eval_data) {
+    const ConvertedNetHeader* header = (const ConvertedNetHeader*)eval_data;
+    const char* d = (const char*)eval_data + sizeof(ConvertedNetHeader);
+
+    n_king_buckets = header->n_king_buckets;
+    mirrored_buckets = header->mirrored_buckets;
+    memcpy(king_buckets, d, sizeof(king_buckets));
+    d += sizeof(king_buckets);
+    memcpy(ft_biases, d, sizeof(ft_biases));
+    d += sizeof(ft_biases);
+    const int16_t* weights = (const int16_t*)d;
+    d += ft_weights_size() * sizeof(int16_t);
+    memcpy(net_hidden_1_biases, d, sizeof(net_hidden_1_biases));
+    d += sizeof(net_hidden_1_biases);
+    memcpy(net_hidden_1_weights, d, sizeof(net_hidden_1_weights));
+    d += sizeof(net_hidden_1_weights);
+    memcpy(net_hidden_2_biases, d, sizeof(net_hidden_2_biases));
+    d += sizeof(net_hidden_2_biases);
+    memcpy(net_hidden_2_weights, d, sizeof(net_hidden_2_weights));
+    d += sizeof(net_hidden_2_weights);
+    memcpy(output_biases, d, sizeof(output_biases));
+    d += sizeof(output_biases);
+    memcpy(output_weights, d, sizeof(output_weights));
+
+    unmap_net();
+    free(ft_weights_buffer);
+    ft_weights_buffer = NULL;
+    ft_weights = weights;
+
+    arrange_weights();
+}
+
+#ifdef EMBEDDED_NET
+// `make embed` converts a net at build time and links it in, in the format of a converted net file
+#ifdef __APPLE__
+#define EMBEDDED_SYMBOL(name) "_" #name
+#define EMBEDDED_SECTION ".const_data"
+#else
+#define EMBEDDED_SYMBOL(name) #name
+#define EMBEDDED_SECTION ".section .rodata"
+#endif
+__asm__(
+    EMBEDDED_SECTION "\n"
+    ".balign 64\n"
+    ".globl " EMBEDDED_SYMBOL(embedded_net_begin) "\n"
+    EMBEDDED_SYMBOL(embedded_net_begin) ":\n"
+    ".incbin \"" EMBEDDED_NET "\"\n"
+    ".globl " EMBEDDED_SYMBOL(embedded_net_end) "\n"
+    EMBEDDED_SYMBOL(embedded_net_end) ":\n"
+    ".text\n"
+);
+extern "C" const char embedded_net_begin[], embedded_net_end[];
+#endif
+
+static int detect_simd_level() {
+#ifdef USE_SIMD_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        if(__builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512vnni"))
+            return SIMD_AVX512_VNNI;
+        return SIMD_AVX512;
+    }
+    if(__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
 #endif
+    return SIMD_SCALAR;
 }
 
 static size_t file_size(int fd) {
@@ -254,61 +555,195 @@ static size_t file_size(int fd) {
     return statbuf.st_size;
 }
 
+// Converted nets are mapped and used in place, nets in the original format are read into our own
+// buffer, and the embedded net, if there is one, is used from the executable. The current net is
+// only replaced if the new one is fine.
 static bool load_eval_file(const char *file_name) {
-    const void *data;
-    size_t size;
-
-    {
-        int fd = open(file_name, 0x0000); 
-        if (fd == -1)
+#ifdef EMBEDDED_NET
+    if(!strcmp(file_name, EMBEDDED_NET_NAME)) {
+        if(!verify_converted_net(embedded_net_begin, embedded_net_end - embedded_net_begin))
             return false;
-        size = file_size(fd);
-        void* _data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-        data = _data == MAP_FAILED ? NULL : _data;
-        close(fd);
+        read_converted_net(embedded_net_begin);
+        return true;
+    }
+#endif
+    int fd = open(file_name, O_RDONLY);
+    if(fd == -1)
+        return false;
+    size_t size = file_size(fd);
+    void* data = size ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(data == MAP_FAILED)
+        return false;
+
+    if(verify_converted_net(data, size)) {
+        read_converted_net(data);
+        mapped_net = data;
+        mapped_net_size = size;
+        return true;
     }
-
     bool success = verify_net(data, size);
-    if (success)
+    if(success)
         read_net(data);
-    if(size && data)
-        munmap((void *)data, size);
+    munmap(data, size);
     return success;
 }
 
-void nnue_init(const char* file_name) {
-    if (load_eval_file(file_name)) {
-        cerr << GREEN_COLOR << "NNUE loaded " << file_name << "!" << endl << RESET_COLOR;
-        nnue_initialized = true;
-        return;
+bool nnue_load(const char* file_name) {
+    simd_level = detect_simd_level();
+    if(!load_eval_file(file_name))
+        return false;
+    nnue_initialized = true;
+    return true;
+}
+
+// nnue_load for the commands, which report on stderr whether it worked
+bool nnue_init(const char* file_name) {
+    if (nnue_load(file_name)) {
+        cerr << GREEN_COLOR << "NNUE loaded " << file_name << " (" << simd_level_names[simd_level] << ")!" << endl << RESET_COLOR;
+        return true;
     }
     cerr << RED_COLOR << "Error loading NNUE file " << file_name << endl << RESET_COLOR;
-    assert(false);
-    while(1); // in case we have -DNDEBUG flag 
+    return false;
+}
+
+// The king buckets of the compact nets nnue_convert derives, for the squares of the queen side
+// from a1 to d8 (the king side ones are mirrored). The ranks close to the king's own side, where it
+// spends most of the game, get the most buckets.
+static const uint8_t compact_king_buckets[3][32] = {
+    // 32: every square
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+      16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31 },
+    // 16: every square of the first three ranks and a bucket per file for the rest
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+      12, 13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15 },
+    // 8: pairs of files on the first two ranks, then the third and fourth, then the rest
+    {  0,  0,  1,  1,  2,  2,  3,  3,  4,  4,  5,  5,  4,  4,  5,  5,
+       6,  6,  7,  7,  6,  6,  7,  7,  6,  6,  7,  7,  6,  6,  7,  7 },
+};
+
+// The weights of a bucket are the average of the weights of its king squares, with the pieces
+// mirrored for the king side squares. It is a starting point to train a compact net from and lets
+// us measure one, it doesn't play as well as the net it comes from.
+static void make_compact_weights(const int16_t* weights, int16_t* compact_weights, uint8_t* square_buckets, int n_buckets) {
+    const uint8_t* buckets = compact_king_buckets[n_buckets == 32 ? 0 : n_buckets == 16 ? 1 : 2];
+    std::vector<int32_t> sums(size_t(kHalfDimensions) * INDEX_END * n_buckets, 0);
+    std::vector<int> n_squares(n_buckets, 0);
+
+    for(int ksq = 0; ksq < 64; ksq++) {
+        const int bucket = buckets[(ksq >> 3) * 4 + ((ksq & 4) ? 7 - (ksq & 7) : (ksq & 7))];
+        square_buckets[ksq] = bucket;
+        n_squares[bucket]++;
+        for(int index = 0; index < INDEX_END; index++) {
+            // index 0 isn't a feature and the pieces start at 1
+            int source = index;
+            if(index && (ksq & 4))
+                source = ((index - 1) & ~63) + (((index - 1) & 63) ^ 7) + 1;
+            for(int i = 0; i < kHalfDimensions; i++)
+                sums[(size_t(bucket) * INDEX_END + index) * kHalfDimensions + i]
+                    += weights[(size_t(ksq) * INDEX_END + source) * kHalfDimensions + i];
+        }
+    }
+
+    for(int bucket = 0; bucket < n_buckets; bucket++)
+        for(size_t i = 0; i < size_t(INDEX_END) * kHalfDimensions; i++) {
+            const size_t idx = size_t(bucket) * INDEX_END * kHalfDimensions + i;
+            compact_weights[idx] = sums[idx] / n_squares[bucket];
+        }
 }
 
-#ifdef USE_AVX2
-void transform(const bool side, Accumulator* acc, clipped_t* output, mask_t* out_mask) {
+// Writes the net in the format load_eval_file maps in place. With 32, 16 or 8 king buckets it
+// derives a compact net from a HalfKP one.
+bool nnue_convert(const char* in_file_name, const char* out_file_name, int n_buckets) {
+    if(!nnue_load(in_file_name))
+        return false;
+    if(n_buckets != n_king_buckets && (n_king_buckets != 64 || (n_buckets != 32 && n_buckets != 16 && n_buckets != 8)))
+        return false;
+
+    std::vector<int16_t> compact_weights;
+    const int16_t* weights = ft_weights;
+    uint8_t buckets[64];
+    bool mirrored = mirrored_buckets;
+    memcpy(buckets, king_buckets, sizeof(buckets));
+    if(n_buckets != n_king_buckets) {
+        compact_weights.resize(size_t(kHalfDimensions) * INDEX_END * n_buckets);
+        make_compact_weights(ft_weights, compact_weights.data(), buckets, n_buckets);
+        weights = compact_weights.data();
+        mirrored = true;
+    }
+
+    FILE* file = fopen(out_file_name, "wb");
+    if(!file)
+        return false;
+
+    ConvertedNetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, converted_net_magic, sizeof(header.magic));
+    header.version = converted_net_version;
+    header.half_dimensions = kHalfDimensions;
+    header.ft_in_dims = INDEX_END * n_buckets;
+    header.hidden_dimensions = 32;
+    header.n_king_buckets = n_buckets;
+    header.mirrored_buckets = mirrored;
+
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(buckets, sizeof(buckets), 1, file) == 1
+        && fwrite(ft_biases, sizeof(ft_biases), 1, file) == 1
+        && fwrite(weights, size_t(kHalfDimensions) * INDEX_END * n_buckets * sizeof(int16_t), 1, file) == 1
+        && fwrite(net_hidden_1_biases, sizeof(net_hidden_1_biases), 1, file) == 1
+        && fwrite(net_hidden_1_weights, sizeof(net_hidden_1_weights), 1, file) == 1
+        && fwrite(net_hidden_2_biases, sizeof(net_hidden_2_biases), 1, file) == 1
+        && fwrite(net_hidden_2_weights, sizeof(net_hidden_2_weights), 1, file) == 1
+        && fwrite(output_biases, sizeof(output_biases), 1, file) == 1
+        && fwrite(output_weights, sizeof(output_weights), 1, file) == 1;
+    return fclose(file) == 0 && success;
+}
+
+static void transform_scalar(const bool side, Accumulator* acc, clipped_t* output) {
+    for(unsigned i = 0; i < kHalfDimensions; i++) {
+        output[i] = clamp(acc->accumulation[side][i], 0, 127);
+        output[i + kHalfDimensions] = clamp(acc->accumulation[!side][i], 0, 127);
+    }
+}
+
+#ifdef USE_SIMD_DISPATCH
+// the inputs are clipped at zero because the first layer takes them as unsigned
+AVX2_TARGET static void transform_avx2(const bool side, Accumulator* acc, clipped_t* output) {
     const bool xside = !side;
+    const __m256i zero = _mm256_setzero_si256();
     unsigned i;
     int16_t (*accumulation)[2][256] = &acc->accumulation;
 
-    const unsigned num_chunks = (16 * kHalfDimensions) / SIMD_WIDTH;
+    const unsigned num_chunks = kHalfDimensions / 16;
 
-    vec8_t* out = (vec8_t*)&output[0];
+    __m256i* out = (__m256i*)&output[0];
     for(i = 0; i < num_chunks / 2; i++) {
-        vec16_t s0 = ((vec16_t*)(*accumulation)[side])[i * 2];
-        vec16_t s1 = ((vec16_t *)(*accumulation)[side])[i * 2 + 1];
-        out[i] = _mm256_packs_epi16(s0, s1);
-        *(out_mask++) = _mm256_movemask_epi8(_mm256_cmpgt_epi8(out[i] ,_mm256_setzero_si256()));
+        __m256i s0 = ((__m256i*)(*accumulation)[side])[i * 2];
+        __m256i s1 = ((__m256i *)(*accumulation)[side])[i * 2 + 1];
+        out[i] = _mm256_max_epi8(_mm256_packs_epi16(s0, s1), zero);
     }
 
-    out = (vec8_t*)&output[kHalfDimensions];
+    out = (__m256i*)&output[kHalfDimensions];
     for(i = 0; i < num_chunks / 2; i++) {
-        vec16_t s0 = ((vec16_t*)(*accumulation)[xside])[i * 2];
-        vec16_t s1 = ((vec16_t *)(*accumulation)[xside])[i * 2 + 1];
-        out[i] = _mm256_packs_epi16(s0, s1);
-        *(out_mask++) = _mm256_movemask_epi8(_mm256_cmpgt_epi8(out[i] ,_mm256_setzero_si256()));
+        __m256i s0 = ((__m256i*)(*accumulation)[xside])[i * 2];
+        __m256i s1 = ((__m256i *)(*accumulation)[xside])[i * 2 + 1];
+        out[i] = _mm256_max_epi8(_mm256_packs_epi16(s0, s1), zero);
+    }
+}
+
+// Packing works inside 128-bit lanes, so we feed it the same blocks as the avx2 version to get the
+// inputs in the same order.
+AVX512_TARGET static void transform_avx512(const bool side, Accumulator* acc, clipped_t* output) {
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i* out = (__m512i*)output;
+
+    for(int perspective = 0; perspective < 2; perspective++) {
+        const __m256i* in = (const __m256i*)acc->accumulation[perspective ? !side : side];
+        for(unsigned i = 0; i < kHalfDimensions / 64; i++) {
+            __m512i s0 = _mm512_inserti64x4(_mm512_castsi256_si512(in[4 * i]), in[4 * i + 2], 1);
+            __m512i s1 = _mm512_inserti64x4(_mm512_castsi256_si512(in[4 * i + 1]), in[4 * i + 3], 1);
+            *(out++) = _mm512_max_epi8(_mm512_packs_epi16(s0, s1), zero);
+        }
     }
 }
 #endif
@@ -325,8 +760,27 @@ inline bool next_idx(unsigned *idx, unsigned *offset, mask2_t *v,
   return true;
 }
 
-#ifdef USE_AVX2
-inline void affine_txfm(int8_t *input, void *output, unsigned inDims,
+
+static void affine_txfm_scalar(clipped_t *input, clipped_t *output, clipped_t *weights, int32_t* biases,
+                               unsigned input_dim, unsigned output_dim) {
+    unsigned i, j;
+    int32_t tmp[output_dim];
+
+    memcpy(tmp, biases, output_dim * sizeof(int32_t));
+
+    for(i = 0; i < input_dim; i++) if(input[i]) { 
+        for(j = 0; j < output_dim; j++) {
+            tmp[j] += (clipped_t)input[i] * weights[output_dim * i + j];
+        }
+    }
+
+    for(i = 0; i < output_dim; i++) {
+        output[i] = (int8_t)clamp((tmp[i] >> SHIFT), 0, 127);
+    }
+}
+
+#ifdef USE_SIMD_DISPATCH
+AVX2_TARGET static void affine_txfm_avx2(int8_t *input, void *output, unsigned inDims,
                         unsigned outDims, const int32_t *biases, const weight_t *weights,
                         mask_t *inMask, mask_t *outMask, const bool pack8_and_calc_mask) {
   assert(outDims == 32);
@@ -373,29 +827,117 @@ inline void affine_txfm(int8_t *input, void *output, unsigned inDims,
   else
     outVec[0] = _mm256_max_epi8(outVec[0], kZero);
 }
-#else
-void affine_txfm(clipped_t *input, clipped_t *output, clipped_t *weights, int32_t* biases,
-                 unsigned input_dim, unsigned output_dim) {
-    unsigned i, j;
-    int32_t tmp[output_dim];
 
-    memcpy(tmp, biases, output_dim * sizeof(int32_t));
+// Most of the inputs of the first layer are zero after the clipping, so it only looks at the 4-byte
+// chunks of the input that aren't. Their indices are listed 8 chunks at a time with a lookup table
+// of the positions of the bits of every byte, instead of scanning a mask bit by bit.
+AVX2_TARGET static int find_nonzero_chunks(const clipped_t* input, unsigned in_dims, uint16_t* nonzero) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m128i increment = _mm_set1_epi16(8);
+    __m128i base = _mm_setzero_si128();
+    int count = 0;
+
+    for(unsigned i = 0; i < in_dims / 32; i++) {
+        // the inputs are at most 127, so a chunk read as a signed integer is only zero or positive
+        const __m256i chunks = _mm256_load_si256((const __m256i*)input + i);
+        const unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(chunks, zero)));
+        const __m128i offsets = _mm_loadu_si128((const __m128i*)bit_positions[mask]);
+        _mm_storeu_si128((__m128i*)(nonzero + count), _mm_add_epi16(base, offsets));
+        count += __builtin_popcount(mask);
+        base = _mm_add_epi16(base, increment);
+    }
+    return count;
+}
 
-    for(i = 0; i < input_dim; i++) if(input[i]) { 
-        for(j = 0; j < output_dim; j++) {
-            tmp[j] += (clipped_t)input[i] * weights[output_dim * i + j];
-        }
+// The weights of every chunk are the 4 weights of each output next to each other, so a chunk is a
+// broadcast and four maddubs, which add pairs of inputs, followed by madds that add the pairs.
+AVX2_TARGET static void affine_txfm_sparse_avx2(const clipped_t* input, clipped_t* output, unsigned in_dims,
+                                                const int32_t* biases, const weight_t* weights, mask_t* out_mask) {
+    alignas(16) uint16_t nonzero[512 / 4 + 8]; // the last store may write 8 indices past the end
+    const int n_nonzero = find_nonzero_chunks(input, in_dims, nonzero);
+    const uint32_t* in = (const uint32_t*)input;
+    const __m256i* w = (const __m256i*)weights;
+    const __m256i ones = _mm256_set1_epi16(1), zero = _mm256_setzero_si256();
+    __m256i out_0 = _mm256_load_si256((const __m256i*)biases);
+    __m256i out_1 = _mm256_load_si256((const __m256i*)biases + 1);
+    __m256i out_2 = _mm256_load_si256((const __m256i*)biases + 2);
+    __m256i out_3 = _mm256_load_si256((const __m256i*)biases + 3);
+
+    for(int i = 0; i < n_nonzero; i++) {
+        const __m256i factor = _mm256_set1_epi32(in[nonzero[i]]);
+        const __m256i* column = w + 4 * nonzero[i];
+        // an input is at most 127, so the sum of two products fits in 16 bits
+        out_0 = _mm256_add_epi32(out_0, _mm256_madd_epi16(_mm256_maddubs_epi16(factor, column[0]), ones));
+        out_1 = _mm256_add_epi32(out_1, _mm256_madd_epi16(_mm256_maddubs_epi16(factor, column[1]), ones));
+        out_2 = _mm256_add_epi32(out_2, _mm256_madd_epi16(_mm256_maddubs_epi16(factor, column[2]), ones));
+        out_3 = _mm256_add_epi32(out_3, _mm256_madd_epi16(_mm256_maddubs_epi16(factor, column[3]), ones));
     }
 
-    for(i = 0; i < output_dim; i++) {
-        output[i] = (int8_t)clamp((tmp[i] >> SHIFT), 0, 127);
+    // packing mixes the lanes, the permutation puts the outputs back in order
+    const __m256i out16_0 = _mm256_srai_epi16(_mm256_packs_epi32(out_0, out_1), SHIFT);
+    const __m256i out16_1 = _mm256_srai_epi16(_mm256_packs_epi32(out_2, out_3), SHIFT);
+    const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_packs_epi16(out16_0, out16_1),
+                                                       _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    _mm256_store_si256((__m256i*)output, _mm256_max_epi8(packed, zero));
+    out_mask[0] = _mm256_movemask_epi8(_mm256_cmpgt_epi8(packed, zero));
+}
+
+VNNI_TARGET static void affine_txfm_sparse_vnni(const clipped_t* input, clipped_t* output, unsigned in_dims,
+                                                const int32_t* biases, const weight_t* weights) {
+    alignas(16) uint16_t nonzero[512 / 4 + 8];
+    const int n_nonzero = find_nonzero_chunks(input, in_dims, nonzero);
+    const __m512i* w = (const __m512i*)weights;
+    const uint32_t* in = (const uint32_t*)input;
+    __m512i out_0 = _mm512_load_si512(biases);
+    __m512i out_1 = _mm512_load_si512(biases + 16);
+
+    for(int i = 0; i < n_nonzero; i++) {
+        const __m512i factor = _mm512_set1_epi32(in[nonzero[i]]);
+        out_0 = _mm512_dpbusd_epi32(out_0, factor, w[2 * nonzero[i]]);
+        out_1 = _mm512_dpbusd_epi32(out_1, factor, w[2 * nonzero[i] + 1]);
+    }
+
+    const __m512i zero = _mm512_setzero_si512();
+    out_0 = _mm512_max_epi32(_mm512_srai_epi32(out_0, SHIFT), zero);
+    out_1 = _mm512_max_epi32(_mm512_srai_epi32(out_1, SHIFT), zero);
+    _mm_store_si128((__m128i*)output, _mm512_cvtsepi32_epi8(out_0));
+    _mm_store_si128((__m128i*)(output + 16), _mm512_cvtsepi32_epi8(out_1));
+}
+
+VNNI_TARGET static void affine_txfm_vnni(const clipped_t* input, clipped_t* output, unsigned in_dims,
+                                         const int32_t* biases, const weight_t* weights) {
+    const __m512i* w = (const __m512i*)weights;
+    const uint32_t* in = (const uint32_t*)input;
+    __m512i out_0 = _mm512_load_si512(biases);
+    __m512i out_1 = _mm512_load_si512(biases + 16);
+
+    for(unsigned i = 0; i < in_dims / 4; i++) {
+        if(!in[i])
+            continue;
+        const __m512i factor = _mm512_set1_epi32(in[i]);
+        out_0 = _mm512_dpbusd_epi32(out_0, factor, w[2 * i]);
+        out_1 = _mm512_dpbusd_epi32(out_1, factor, w[2 * i + 1]);
     }
+
+    const __m512i zero = _mm512_setzero_si512();
+    out_0 = _mm512_max_epi32(_mm512_srai_epi32(out_0, SHIFT), zero);
+    out_1 = _mm512_max_epi32(_mm512_srai_epi32(out_1, SHIFT), zero);
+    _mm_store_si128((__m128i*)output, _mm512_cvtsepi32_epi8(out_0));
+    _mm_store_si128((__m128i*)(output + 16), _mm512_cvtsepi32_epi8(out_1));
 }
 #endif
 
-int32_t affine_propagate(clipped_t* input, clipped_t* weights, int32_t* biases, 
-                         unsigned input_dim) {
-#ifdef USE_AVX2
+static int32_t affine_propagate_scalar(clipped_t* input, clipped_t* weights, int32_t* biases,
+                                       unsigned input_dim) {
+    int32_t ans = biases[0];
+    for(unsigned i = 0; i < input_dim; i++) {
+        ans += input[i] * weights[i];
+    }
+    return ans;
+}
+
+#ifdef USE_SIMD_DISPATCH
+AVX2_TARGET static int32_t affine_propagate_avx2(clipped_t* input, clipped_t* weights, int32_t* biases) {
   __m256i *iv = (__m256i *)input;
   __m256i *row = (__m256i *)weights;
   __m256i prod = _mm256_maddubs_epi16(iv[0], row[0]);
@@ -404,38 +946,106 @@ int32_t affine_propagate(clipped_t* input, clipped_t* weights, int32_t* biases,
       _mm256_castsi256_si128(prod), _mm256_extracti128_si256(prod, 1));
   sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x1b));
   return _mm_cvtsi128_si32(sum) + _mm_extract_epi32(sum, 1) + biases[0];
-#else
-    int32_t ans = biases[0];
-    for(unsigned i = 0; i < input_dim; i++) {
-        ans += input[i] * weights[i];
-    }
-    return ans;
-#endif
 }
 
+VNNI_TARGET static int32_t affine_propagate_vnni(clipped_t* input, clipped_t* weights, int32_t* biases) {
+  __m256i prod = _mm256_dpbusd_epi32(_mm256_setzero_si256(), *(__m256i *)input, *(__m256i *)weights);
+  __m128i sum = _mm_add_epi32(
+      _mm256_castsi256_si128(prod), _mm256_extracti128_si256(prod, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+  return _mm_cvtsi128_si32(sum) + biases[0];
+}
+#endif
+
 struct NetData {
     alignas(64) clipped_t input[512];
-    clipped_t hidden_1_out[32];
-    clipped_t hidden_2_out[32];
+    alignas(32) clipped_t hidden_1_out[32];
+    alignas(32) clipped_t hidden_2_out[32];
+    alignas(8) mask_t hidden1_mask[8 / sizeof(mask_t)];
 };
 
-int nnue_eval(Board* board) {
-    if(!nnue_initialized)
-        nnue_init(NNUE_PATH);
+// Runs the network on up to NNUE_BATCH_SIZE computed accumulators with the kernels of the current
+// simd level. Every layer goes through the whole batch before the next one, so the weights of a
+// layer are loaded into the cache once per batch instead of once per position.
+static void propagate_batch(Accumulator* const* accs, const bool* sides, int n, int32_t* scores) {
+    NetData bufs[NNUE_BATCH_SIZE];
+    assert(n <= NNUE_BATCH_SIZE);
+
+    switch(simd_level) {
+#ifdef USE_SIMD_DISPATCH
+        case SIMD_AVX512_VNNI:
+            for(int b = 0; b < n; b++)
+                transform_avx512(sides[b], accs[b], bufs[b].input);
+            for(int b = 0; b < n; b++)
+                affine_txfm_sparse_vnni(bufs[b].input, bufs[b].hidden_1_out, 512, hidden_1_biases, hidden_1_weights);
+            for(int b = 0; b < n; b++)
+                affine_txfm_vnni(bufs[b].hidden_1_out, bufs[b].hidden_2_out, 32, hidden_2_biases, hidden_2_weights);
+            for(int b = 0; b < n; b++)
+                scores[b] = affine_propagate_vnni(bufs[b].hidden_2_out, output_weights, output_biases);
+            break;
+        case SIMD_AVX512: case SIMD_AVX2:
+            for(int b = 0; b < n; b++) {
+                if(simd_level == SIMD_AVX512)
+                    transform_avx512(sides[b], accs[b], bufs[b].input);
+                else
+                    transform_avx2(sides[b], accs[b], bufs[b].input);
+            }
+            for(int b = 0; b < n; b++) {
+                memset(bufs[b].hidden1_mask, 0, sizeof(bufs[b].hidden1_mask));
+                affine_txfm_sparse_avx2(bufs[b].input, bufs[b].hidden_1_out, 512, hidden_1_biases,
+                    hidden_1_weights, bufs[b].hidden1_mask);
+            }
+            for(int b = 0; b < n; b++)
+                affine_txfm_avx2(bufs[b].hidden_1_out, bufs[b].hidden_2_out, 32, 32, hidden_2_biases,
+                    hidden_2_weights, bufs[b].hidden1_mask, NULL, false);
+            for(int b = 0; b < n; b++)
+                scores[b] = affine_propagate_avx2(bufs[b].hidden_2_out, output_weights, output_biases);
+            break;
+#endif
+        default:
+            for(int b = 0; b < n; b++)
+                transform_scalar(sides[b], accs[b], bufs[b].input);
+            for(int b = 0; b < n; b++)
+                affine_txfm_scalar(bufs[b].input, bufs[b].hidden_1_out, hidden_1_weights, hidden_1_biases, 512, 32);
+            for(int b = 0; b < n; b++)
+                affine_txfm_scalar(bufs[b].hidden_1_out, bufs[b].hidden_2_out, hidden_2_weights, hidden_2_biases, 32, 32);
+            for(int b = 0; b < n; b++)
+                scores[b] = affine_propagate_scalar(bufs[b].hidden_2_out, output_weights, output_biases, 32);
+    }
+}
+
+static int32_t propagate(Accumulator* acc, const bool side) {
+    int32_t score;
+    propagate_batch(&acc, &side, 1, &score);
+    return score;
+}
 
-    Accumulator* acc = &board->acc_stack[board->acc_stack_size & 7];
-    struct NetData buf;
+// brings the accumulator of the current position up to date
+static Accumulator* update_accumulator(Board* board) {
+    Accumulator* acc = &board->acc_stack[board->acc_stack_size & (ACC_STACK_SIZE - 1)];
 
 #ifdef INCREMENTAL_NNUE
-    if(!acc->has_been_computed) {
+    // a king move only forces a refresh of its own perspective, the other one is still updated
+    for(int perspective = WHITE; perspective <= BLACK; perspective++) {
+        if(acc->computed[perspective])
+            continue;
+
+        // We walk back to the nearest computed ancestor, as long as rolling its changes forward is
+        // cheaper than a refresh, which has to add a feature for every piece on the board.
+        const int max_changes = popcnt(board->occ_mask) - 2;
+        int n_changes = 0;
         bool found_computed = false;
-        // most of the updates (99%) are made with the newest or the second-newest accumulator
-        // so there's no need to check older ones
         int i;
-        for(i = board->acc_stack_size - 1; i >= 0 && i >= board->acc_stack_size - 2; i--) {
-            if(!board->dp_stack[i & 7].no_king)
+        for(i = board->acc_stack_size - 1; i >= 0 && i > board->acc_stack_size - ACC_STACK_SIZE; i--) {
+            DirtyPiece* dp = &board->dp_stack[i & (ACC_STACK_SIZE - 1)];
+            // the moving piece is always the first one
+            if(dp->king_moved[perspective] && king_features_change(dp->from[0], dp->to[0], perspective))
                 break;
-            if(board->acc_stack[i & 7].has_been_computed) {
+            n_changes += changed_features(dp);
+            if(n_changes > max_changes)
+                break;
+            if(board->acc_stack[i & (ACC_STACK_SIZE - 1)].computed[perspective]) {
                 found_computed = true;
                 break;
             }
@@ -445,50 +1055,210 @@ int nnue_eval(Board* board) {
             IndexList added_indices, removed_indices;
             added_indices.size = removed_indices.size = 0;
             for(int j = i; j < board->acc_stack_size; j++)
-                append_changed_indices(&added_indices, &removed_indices, board, &board->dp_stack[j & 7]);
-            assert(board->acc_stack[i & 7].has_been_computed);
-            update_acc(acc, &board->acc_stack[i & 7], &added_indices, &removed_indices);
+                append_changed_indices(&added_indices, &removed_indices, board, &board->dp_stack[j & (ACC_STACK_SIZE - 1)], perspective);
+            update_acc(acc, &board->acc_stack[i & (ACC_STACK_SIZE - 1)], &added_indices, &removed_indices, perspective);
+            if(board->nnue_stats) {
+                board->nnue_stats->updates++;
+                board->nnue_stats->updated_plies += board->acc_stack_size - i;
+            }
+        } else if(board->acc_cache) {
+            refresh_acc(acc, board, board->acc_cache, perspective);
+            if(board->nnue_stats)
+                board->nnue_stats->cached_refreshes++;
+#ifndef NDEBUG
+            Accumulator full_acc;
+            IndexList index_list;
+            index_list.size = 0;
+            append_active_indices(&index_list, board);
+            compute_acc(&full_acc, &index_list, perspective);
+            assert(!memcmp(full_acc.accumulation[perspective], acc->accumulation[perspective], sizeof(acc->accumulation[perspective])));
+#endif
         } else {
             IndexList index_list;
             index_list.size = 0;
             append_active_indices(&index_list, board);
-            compute_acc(acc, &index_list);
+            compute_acc(acc, &index_list, perspective);
+            if(board->nnue_stats)
+                board->nnue_stats->refreshes++;
         }
     }
 #else
-    if(!acc->has_been_computed) {
+    for(int perspective = WHITE; perspective <= BLACK; perspective++) if(!acc->computed[perspective]) {
         IndexList index_list;
         index_list.size = 0;
         append_active_indices(&index_list, board);
-        compute_acc(acc, &index_list);
+        compute_acc(acc, &index_list, perspective);
     }
 #endif
 
-    assert(acc->has_been_computed);
+    assert(acc->computed[WHITE] && acc->computed[BLACK]);
+    return acc;
+}
 
-#ifndef USE_AVX2
-    for(unsigned i = 0; i < kHalfDimensions; i++) {
-        buf.input[i] = clamp(acc->accumulation[board->side][i], 0, 127);
-        buf.input[i + 256] = clamp(acc->accumulation[board->xside][i], 0, 127);
+int nnue_eval(Board* board) {
+    int score;
+    // on a hit the accumulator is left alone, the children update theirs from an older one
+    if(board->eval_cache && board->eval_cache->probe(board->key, score)) {
+        if(board->nnue_stats)
+            board->nnue_stats->cached_evals++;
+        return score;
     }
 
-    affine_txfm(buf.input, buf.hidden_1_out, hidden_1_weights, hidden_1_biases, 512, 32);
+    assert(nnue_initialized); // the uci loop or the command loads the net up front
+    int32_t nnue_score = propagate(update_accumulator(board), board->side);
+    score = nnue_score / FV_SCALE;
 
-    affine_txfm(buf.hidden_1_out, buf.hidden_2_out, hidden_2_weights, hidden_2_biases, 32, 32);
-#else
-    alignas(8) mask_t input_mask[512 / (8 * sizeof(mask_t))];
-    alignas(8) mask_t hidden1_mask[8 / sizeof(mask_t)] = { 0 };
+    if(board->eval_cache)
+        board->eval_cache->store(board->key, score);
+    if(board->nnue_stats)
+        board->nnue_stats->evals++;
+    return score;
+}
 
-    transform(board->side, acc, buf.input, input_mask);
+// the accumulators of every board are brought up to date first and then the net runs on them in batches
+void nnue_eval_batch(Board* const* boards, int n_boards, int* scores) {
+    Accumulator* accs[NNUE_BATCH_SIZE];
+    bool sides[NNUE_BATCH_SIZE];
+    int32_t nnue_scores[NNUE_BATCH_SIZE];
+
+    assert(nnue_initialized);
+    for(int start = 0; start < n_boards; start += NNUE_BATCH_SIZE) {
+        const int n = std::min(NNUE_BATCH_SIZE, n_boards - start);
+        for(int b = 0; b < n; b++) {
+            accs[b] = update_accumulator(boards[start + b]);
+            sides[b] = boards[start + b]->side;
+        }
+        propagate_batch(accs, sides, n, nnue_scores);
+        for(int b = 0; b < n; b++)
+            scores[start + b] = nnue_scores[b] / FV_SCALE;
+    }
+}
 
-    affine_txfm(buf.input, buf.hidden_1_out, 512, 32, hidden_1_biases,
-        hidden_1_weights, input_mask, hidden1_mask, true); 
+static double percentage(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0.0;
+}
 
-    affine_txfm(buf.hidden_1_out, buf.hidden_2_out, 32, 32, hidden_2_biases,
-        hidden_2_weights, hidden1_mask, NULL, false); 
-#endif
+void nnue_print_stats() {
+    const uint64_t total = nnue_stats.updates + nnue_stats.refreshes + nnue_stats.cached_refreshes;
+    printf("info string nnue accumulators %" PRIu64 " updates %" PRIu64 " (%.1f%%, %.2f plies on average) refreshes %" PRIu64 " (%.1f%%) cached refreshes %" PRIu64 " (%.1f%%)\n",
+           total, nnue_stats.updates, percentage(nnue_stats.updates, total),
+           nnue_stats.updates ? double(nnue_stats.updated_plies) / nnue_stats.updates : 0.0,
+           nnue_stats.refreshes, percentage(nnue_stats.refreshes, total),
+           nnue_stats.cached_refreshes, percentage(nnue_stats.cached_refreshes, total));
+    const uint64_t scores = nnue_stats.evals + nnue_stats.cached_evals + nnue_stats.tt_evals;
+    printf("info string nnue scores %" PRIu64 " evals %" PRIu64 " (%.1f%%) eval cache %" PRIu64 " (%.1f%%) tt %" PRIu64 " (%.1f%%)\n",
+           scores, nnue_stats.evals, percentage(nnue_stats.evals, scores),
+           nnue_stats.cached_evals, percentage(nnue_stats.cached_evals, scores),
+           nnue_stats.tt_evals, percentage(nnue_stats.tt_evals, scores));
+    fflush(stdout);
+}
+
+template<typename F>
+static double ns_per_call(F f, int iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < iterations; i++) {
+        f();
+        // keeps the compiler from merging the iterations
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
 
-    int32_t nnue_score = affine_propagate(buf.hidden_2_out, output_weights, output_biases, 32);
+// Times a refresh, one through the accumulator cache, an update like the one of a capture (two
+// features removed and one added) and a whole eval with every simd level the cpu supports, and
+// checks them against the scalar code.
+void nnue_acc_bench(Board* boards, int n_boards) {
+    assert(nnue_initialized);
+
+    const int iterations = 20000;
+    const int best_level = simd_level;
+    std::vector<int> scalar_evals(n_boards);
+    Accumulator acc, ref_acc, prev_acc;
+    static AccumulatorCache cache;
+
+    for(int level = SIMD_SCALAR; level <= best_level; level++) {
+        double refresh = 0, cached_refresh = 0, update = 0, net = 0, eval = 0;
+        bool same_result = true;
+        simd_level = level;
+        arrange_weights();
+        cache.clear();
+
+        for(int i = 0; i < n_boards; i++) {
+            Board* board = &boards[i];
+            IndexList active, added, removed;
+            active.size = 0;
+            append_active_indices(&active, board);
+            for(int perspective = WHITE; perspective <= BLACK; perspective++) {
+                removed.values[perspective][0] = active.values[perspective][0];
+                removed.values[perspective][1] = active.values[perspective][1];
+                added.values[perspective][0] = active.values[perspective][2];
+            }
+            removed.size = 2;
+            added.size = 1;
+            for(int perspective = WHITE; perspective <= BLACK; perspective++)
+                compute_acc(&prev_acc, &active, perspective);
+
+            refresh += ns_per_call([&] {
+                for(int perspective = WHITE; perspective <= BLACK; perspective++)
+                    compute_acc(&acc, &active, perspective);
+            }, iterations);
+            for(int perspective = WHITE; perspective <= BLACK; perspective++)
+                apply_features_scalar(ref_acc.accumulation[perspective], ft_biases, NULL, 0,
+                                      active.values[perspective], active.size);
+            same_result &= !memcmp(acc.accumulation, ref_acc.accumulation, sizeof(acc.accumulation));
+
+            // like a refresh after a king move, when the knights have changed since the cached accumulator
+            for(int perspective = WHITE; perspective <= BLACK; perspective++)
+                refresh_acc(&acc, board, &cache, perspective);
+            same_result &= !memcmp(acc.accumulation, ref_acc.accumulation, sizeof(acc.accumulation));
+            cached_refresh += ns_per_call([&] {
+                for(int perspective = WHITE; perspective <= BLACK; perspective++) {
+                    const int ksq = orient(lsb(board->bits[make_piece(KING, perspective)]), perspective);
+                    cache.entries[perspective][ksq].bits[WHITE_KNIGHT] = 0;
+                    cache.entries[perspective][ksq].bits[BLACK_KNIGHT] = 0;
+                    refresh_acc(&acc, board, &cache, perspective);
+                }
+            }, iterations);
+            // the accumulators of those entries don't match their pieces anymore
+            for(int perspective = WHITE; perspective <= BLACK; perspective++)
+                cache.entries[perspective][orient(lsb(board->bits[make_piece(KING, perspective)]), perspective)].valid = false;
+
+            update += ns_per_call([&] {
+                for(int perspective = WHITE; perspective <= BLACK; perspective++)
+                    update_acc(&acc, &prev_acc, &added, &removed, perspective);
+            }, iterations);
+            for(int perspective = WHITE; perspective <= BLACK; perspective++)
+                apply_features_scalar(ref_acc.accumulation[perspective], prev_acc.accumulation[perspective],
+                                      removed.values[perspective], removed.size, added.values[perspective], added.size);
+            same_result &= !memcmp(acc.accumulation, ref_acc.accumulation, sizeof(acc.accumulation));
+
+            Accumulator* board_acc = &board->acc_stack[board->acc_stack_size & (ACC_STACK_SIZE - 1)];
+            eval += ns_per_call([&] { board_acc->computed[WHITE] = board_acc->computed[BLACK] = false; nnue_eval(board); }, iterations);
+            // the layers after the feature transformer alone
+            net += ns_per_call([&] { propagate(board_acc, board->side); }, iterations);
+            if(level == SIMD_SCALAR)
+                scalar_evals[i] = nnue_eval(board);
+            else
+                same_result &= nnue_eval(board) == scalar_evals[i];
+        }
+
+        // the batched evals must match too
+        std::vector<Board*> batch(n_boards);
+        std::vector<int> batch_evals(n_boards);
+        for(int i = 0; i < n_boards; i++) {
+            batch[i] = &boards[i];
+            Accumulator* board_acc = &boards[i].acc_stack[boards[i].acc_stack_size & (ACC_STACK_SIZE - 1)];
+            board_acc->computed[WHITE] = board_acc->computed[BLACK] = false;
+        }
+        nnue_eval_batch(batch.data(), n_boards, batch_evals.data());
+        same_result &= batch_evals == scalar_evals;
+
+        printf("%-12s refresh: %7.1f ns, cached refresh: %6.1f ns, update: %6.1f ns, net: %6.1f ns, eval with refresh: %7.1f ns%s\n",
+               simd_level_names[level], refresh / n_boards, cached_refresh / n_boards, update / n_boards, net / n_boards, eval / n_boards,
+               same_result ? "" : " (results differ from scalar!)");
+    }
 
-    return (nnue_score / FV_SCALE);
+    simd_level = best_level;
+    arrange_weights();
 }
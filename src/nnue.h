@@ -1,18 +1,97 @@
 
 #pragma once
 
+// boards evaluated together by nnue_eval_batch
+const int NNUE_BATCH_SIZE = 16;
+
 int nnue_eval(Board* board);
-void nnue_init(const char* file_name);
+void nnue_eval_batch(Board* const* boards, int n_boards, int* scores);
+bool nnue_init(const char* file_name);
+bool nnue_load(const char* file_name);
+bool nnue_convert(const char* in_file_name, const char* out_file_name, int n_king_buckets = 64);
+void nnue_acc_bench(Board* boards, int n_boards);
+void nnue_print_stats();
+
+// the accumulator stack covers a whole search, so an update can start from any computed ancestor
+const int ACC_STACK_SIZE = MAX_PLY;
+static_assert((ACC_STACK_SIZE & (ACC_STACK_SIZE - 1)) == 0, "The accumulator stack is a ring indexed with a mask");
 
 struct Accumulator {
-    bool has_been_computed;
+    bool computed[2]; // each perspective is updated on its own
     alignas(64) int16_t accumulation[2][256];
 };
 
+// The accumulator of the last position seen with the king on each square, for each perspective,
+// together with the pieces it was computed from. After a king move we only have to apply the pieces
+// that changed since then instead of all of them.
+struct AccumulatorCacheEntry {
+    alignas(64) int16_t accumulation[256];
+    uint64_t bits[12];
+    bool valid;
+};
+
+struct AccumulatorCache {
+    AccumulatorCacheEntry entries[2][64];
+
+    void clear() {
+        for(int perspective = 0; perspective < 2; perspective++)
+            for(int sq = 0; sq < 64; sq++)
+                entries[perspective][sq].valid = false;
+    }
+};
+
 struct DirtyPiece {
     int dirtyNum;
-    bool no_king;
+    bool king_moved[2];
     int pc[3];
     int from[3];
     int to[3];
-};
\ No newline at end of file
+};
+// How the accumulators were brought up to date, counted per perspective. Like the tt stats every
+// search thread counts into its own and they are summed when the search is over.
+struct NnueStats {
+    uint64_t updates, updated_plies, refreshes, cached_refreshes;
+    uint64_t evals, cached_evals, tt_evals; // where the scores came from
+
+    NnueStats() {
+        updates = updated_plies = refreshes = cached_refreshes = 0;
+        evals = cached_evals = tt_evals = 0;
+    }
+
+    void add(const NnueStats& other) {
+        updates += other.updates;
+        updated_plies += other.updated_plies;
+        refreshes += other.refreshes;
+        cached_refreshes += other.cached_refreshes;
+        evals += other.evals;
+        cached_evals += other.cached_evals;
+        tt_evals += other.tt_evals;
+    }
+};
+
+// The scores of the last positions evaluated, keyed by their zobrist key, so that transpositions
+// and the stand pat of positions we just searched don't run the net again. Every search thread
+// has its own, so it needs no locks. An entry keeps the upper 48 bits of the key and the score.
+struct EvalCache {
+    static const int N_ENTRIES = 1 << 14;
+    uint64_t entries[N_ENTRIES];
+
+    void clear() {
+        for(int i = 0; i < N_ENTRIES; i++)
+            entries[i] = 0;
+    }
+
+    bool probe(uint64_t key, int& score) const {
+        const uint64_t entry = entries[key & (N_ENTRIES - 1)];
+        if((entry ^ key) >> 16)
+            return false;
+        score = int16_t(entry & 0xffff);
+        return true;
+    }
+
+    void store(uint64_t key, int score) {
+        entries[key & (N_ENTRIES - 1)] = (key & ~uint64_t(0xffff)) | uint16_t(score);
+    }
+};
+
+extern NnueStats nnue_stats;
@@ -1,11 +1,14 @@
 #include <vector>
+#include <thread>
 #include <chrono>
 #include <iostream>
 #include <cassert>
+#include <cstdlib>
 #include <sys/timeb.h>
 #include "magicmoves.h"
 #include "defs.h"
 #include "board.h"
+#include "gen.h"
 #include "sungorus_eval.h"
 #include "tt.h"
 #include "move_picker.h"
@@ -29,23 +32,23 @@ static const double LMR_constant = -1.75;
 static const double LMR_coeff = 1.03;
 static int LMR[64][64];
 static std::chrono::time_point<std::chrono::system_clock> initial_time;
-static std::chrono::duration<float, std::milli> duration;
+
+// helper threads skip some iterations so that they don't all search the same depth (taken from Stockfish)
+static const int skip_size[16] = { 1, 1, 1, 2, 2, 2, 1, 3, 2, 2, 1, 3, 3, 2, 2, 1 };
+static const int skip_phase[16] = { 0, 1, 0, 1, 2, 3, 1, 2, 3, 4, 0, 1, 2, 3, 4, 5 };
 
 // returns elapsed time since search started in ms 
 static inline int elapsed_time() {
-    duration = std::chrono::system_clock::now() - initial_time;
+    const std::chrono::duration<float, std::milli> duration = std::chrono::system_clock::now() - initial_time;
     return int(duration.count());
 }
 
 void think(Engine& engine) {
-    tt.total_saved = 0;
-    tt.total_tried_save = 0;
-    tt.totally_replaced = 0;
     engine.stop_search = false;
     max_search_time = engine.max_search_time;
     max_depth = engine.max_depth;
     assert(max_depth <= MAX_PLY);
-    Thread main_thread = Thread(engine.board, &engine.stop_search);
+    Thread main_thread(engine.board, &engine.stop_search);
     tt.age();
 
     for(int depth = 0; depth < futility_max_depth; depth++) {
@@ -58,26 +61,68 @@ void think(Engine& engine) {
 		}
 	}
 
-    // PV pv;
-    // for(main_thread.depth = 1; !(*main_thread.stop_search) && main_thread.depth <= engine.max_depth; main_thread.depth += 1) {
-    //     main_thread.root_value = search(main_thread, pv, -INF, INF, main_thread.depth);
-    //     main_thread.best_move = pv[0];
-    //     if(engine.stop_search) {
-    //         break;
-    //     }
-    // }
+    // lazy smp: the helpers share nothing but the tt with the main thread
+    // (reserved up front, the workers keep references to them)
+    const int n_helpers = engine.threads - 1;
+    std::vector<Thread> helpers;
+    helpers.reserve(n_helpers);
+    std::vector<std::thread> workers;
+    for(int i = 0; i < n_helpers; i++) {
+        helpers.emplace_back(engine.board, &engine.stop_search, i + 1);
+    }
 
     initial_time = std::chrono::system_clock::now(); 
-    for(main_thread.depth = 1; !(*main_thread.stop_search) && main_thread.depth <= engine.max_depth; main_thread.depth += 1) {
-        aspiration_window(main_thread);
+    for(int i = 0; i < n_helpers; i++) {
+        workers.emplace_back(iterative_deepening, std::ref(helpers[i]), engine.max_depth);
     }
 
-    assert(main_thread.best_move != NULL_MOVE);
-    engine.search_time = elapsed_time();
+    iterative_deepening(main_thread, engine.max_depth);
+
+    // the main thread is done, the helpers must stop too
+    engine.stop_search = true;
+    for(int i = 0; i < (int)workers.size(); i++) {
+        workers[i].join();
+    }
+
+    // we pick the result of the thread which completed the deepest iteration
+    Thread* best_thread = &main_thread;
     engine.nodes = main_thread.nodes;
-    engine.best_move = main_thread.best_move;
-    engine.score = main_thread.root_value;
-    engine.ponder_move = main_thread.ponder_move;
+    tt.stats.add(main_thread.tt_stats);
+    nnue_stats.add(main_thread.nnue_stats);
+    for(int i = 0; i < n_helpers; i++) {
+        engine.nodes += helpers[i].nodes;
+        tt.stats.add(helpers[i].tt_stats);
+        nnue_stats.add(helpers[i].nnue_stats);
+        if(helpers[i].best_move != NULL_MOVE
+        && (helpers[i].completed_depth > best_thread->completed_depth
+        || (helpers[i].completed_depth == best_thread->completed_depth && helpers[i].root_value > best_thread->root_value))) {
+            best_thread = &helpers[i];
+        }
+    }
+
+    // stopped before any thread completed an iteration: any legal move is better than none
+    if(best_thread->best_move == NULL_MOVE) {
+        MoveList moves;
+        generate_moves(moves, &engine.board);
+        if(!moves.empty())
+            best_thread->best_move = moves[0];
+    }
+
+    engine.search_time = elapsed_time();
+    engine.best_move = best_thread->best_move;
+    engine.score = best_thread->root_value;
+    engine.ponder_move = best_thread->ponder_move;
+}
+
+void iterative_deepening(Thread& thread, int max_iter_depth) {
+    for(thread.depth = 1; !(*thread.stop_search) && thread.depth <= max_iter_depth; thread.depth += 1) {
+        if(thread.index > 0) {
+            const int i = (thread.index - 1) % 16;
+            if(((thread.depth + skip_phase[i]) / skip_size[i]) % 2)
+                continue;
+        }
+        aspiration_window(thread);
+    }
 }
 
 void aspiration_window(Thread& thread) {
@@ -101,9 +146,14 @@ void aspiration_window(Thread& thread) {
 
         assert(thread.ply == 0);
 
+        // an aborted iteration returns 0 and may have no pv, we keep the last completed one
+        if(*thread.stop_search)
+            return;
+
         if(score > alpha && score < beta) {
             assert(pv.size() > 0);
             thread.root_value = score;
+            thread.completed_depth = thread.depth;
             thread.best_move = pv[0];
             thread.ponder_move = pv.size() > 1 ? pv[1] : NULL_MOVE;
             return;
@@ -160,12 +210,12 @@ int search(Thread& thread, PV& pv, int alpha, int beta, int depth) {
     
     pv.clear();
     Move tt_move = NULL_MOVE;
-    int tt_score = INF, tt_bound = -1;
+    int tt_score = INF, tt_bound = -1, tt_eval;
 
     // it will return true if it causes a cutoff or is an exact value
     if(tt.retrieve(
-        thread.board.key, tt_move,
-        tt_score, tt_bound, alpha, beta, depth, thread.ply
+        thread.tt_stats, thread.board.key, tt_move,
+        tt_score, tt_bound, tt_eval, alpha, beta, depth, thread.ply
     )) {
         // we don't add it to the pv because it could be illegal move
         return tt_score;
@@ -182,7 +232,15 @@ int search(Thread& thread, PV& pv, int alpha, int beta, int depth) {
     Move *captures_p = captures_tried, *quiets_p = quiets_tried;
 
     int score, best_score = -CHECKMATE, searched_moves = 0, extended_depth, reduction;
-    int eval_score = tt_score != INF ? tt_score : nnue_eval(&thread.board);
+    // the static eval is saved with the tt entry, even when its score isn't deep enough to be used
+    int static_eval = tt_eval;
+    if(tt_score == INF) {
+        if(static_eval == NO_EVAL)
+            static_eval = nnue_eval(&thread.board);
+        else
+            thread.nnue_stats.tt_evals++;
+    }
+    int eval_score = tt_score != INF ? tt_score : static_eval;
     // int eval_score = tt_score != INF ? tt_score : evaluate(thread.board);
 
     // beta pruning
@@ -245,10 +303,7 @@ int search(Thread& thread, PV& pv, int alpha, int beta, int depth) {
             continue;
 
         thread.board.new_make_move(move, undo_data);
-        if(thread.board.opp_king_attacked()) {
-            thread.board.new_take_back(undo_data);
-            continue;
-        }
+        assert(!thread.board.opp_king_attacked()); // the move picker only returns legal moves
 
         thread.ply++;
 
@@ -305,9 +360,9 @@ int search(Thread& thread, PV& pv, int alpha, int beta, int depth) {
                 pv.push_back(move);
                 pv.insert(pv.end(), child_pv.begin(), child_pv.end());
 
-                if(is_root) {
-                    printf("info depth %d time %d nodes %d cp score %d pv",
-                           thread.depth, elapsed_time(), thread.nodes, thread.root_value);
+                if(is_root && thread.index == 0) {
+                    printf("info depth %d time %d nodes %d hashfull %d cp score %d pv",
+                           thread.depth, elapsed_time(), thread.nodes, tt.hashfull(), thread.root_value);
                     for(int i = 0; i < (int)pv.size(); i++) {
                         printf(" %s", move_to_str(pv[i]).c_str());
                     }
@@ -342,18 +397,18 @@ int search(Thread& thread, PV& pv, int alpha, int beta, int depth) {
     // } else
     if(best_score >= beta) {
         tt.save(
-            thread.board.key, best_move, best_score,
-            LOWER_BOUND, depth, thread.ply
+            thread.tt_stats, thread.board.key, best_move, best_score,
+            LOWER_BOUND, depth, thread.ply, static_eval
         );
     } else if(best_score <= alpha) {
         tt.save(
-            thread.board.key, best_move, alpha,
-            UPPER_BOUND, depth, thread.ply
+            thread.tt_stats, thread.board.key, best_move, alpha,
+            UPPER_BOUND, depth, thread.ply, static_eval
         );
     } else {
         tt.save(
-            thread.board.key, best_move, best_score,
-            EXACT_BOUND, depth, thread.ply
+            thread.tt_stats, thread.board.key, best_move, best_score,
+            EXACT_BOUND, depth, thread.ply, static_eval
         );
     }
 
@@ -392,12 +447,12 @@ int q_search(Thread& thread, int alpha, int beta) {
     
     // pv.clear();
     Move tt_move = NULL_MOVE;
-    int score, tt_score, tt_bound = -1;
+    int score, tt_score, tt_bound = -1, tt_eval;
 
     // it will return true if it causes a cutoff or is an exact value
     if(tt.retrieve(
-        thread.board.key, tt_move,
-        tt_score, tt_bound, alpha, beta, 0, thread.ply
+        thread.tt_stats, thread.board.key, tt_move,
+        tt_score, tt_bound, tt_eval, alpha, beta, 0, thread.ply
     ))
        return tt_score; 
 
@@ -428,11 +483,7 @@ int q_search(Thread& thread, int alpha, int beta) {
         assert(!in_check || get_flag(move) != CASTLING_MOVE);
 
         thread.board.new_make_move(move, undo_data); 
-
-        if(thread.board.opp_king_attacked()) {
-            thread.board.new_take_back(undo_data);
-            continue;
-        }
+        assert(!thread.board.opp_king_attacked());
 
         thread.ply++;
 
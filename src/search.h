@@ -1,11 +1,14 @@
 #pragma once
 
 #include <iostream>
+#include <atomic>
 #include "board.h"
 #include "defs.h"
 #include "engine.h"
+#include "tt.h"
 
 void think(Engine&);
+void iterative_deepening(Thread&, int);
 void aspiration_window(Thread&);
 int search(Thread&, PV&, int, int, int);
 int q_search(Thread&, int, int);
@@ -15,7 +18,7 @@ void update_quiet_history(Thread&, const Move, Move*, Move*, const int);
 void update_capture_history(Thread&, const Move, Move*, Move*, const int);
 
 struct Thread {
-   int ply, index, depth, nodes, root_value;     
+   int ply, index, depth, nodes, root_value, completed_depth;
    Move best_move, ponder_move;
    Board board;
 //    std::vector<Move> move_stack;
@@ -24,14 +27,24 @@ struct Thread {
    Move killers[MAX_PLY][2] = {{ NULL_MOVE }};
    int quiet_history[2][64][64] = {{{ 0 }}};
    int capture_history[6][64][6] = {{{ 0 }}};
-   bool* stop_search;
+   std::atomic<bool>* stop_search;
+   TTStats tt_stats;
+   AccumulatorCache acc_cache;
+   NnueStats nnue_stats;
+   EvalCache eval_cache;
 
-    Thread(Board _board, bool* _stop_search) {
-        best_move = NULL_MOVE;
+    Thread(Board _board, std::atomic<bool>* _stop_search, int _index = 0) {
+        best_move = ponder_move = NULL_MOVE;
         root_value = -1;
-        nodes = index = ply = 0;
+        nodes = ply = completed_depth = 0;
+        index = _index;
         depth = 1;
         board = _board;
+        board.acc_cache = &acc_cache;
+        board.nnue_stats = &nnue_stats;
+        board.eval_cache = &eval_cache;
+        eval_cache.clear();
+        acc_cache.clear();
         stop_search = _stop_search;
         // *stop_search = false;
     }
@@ -2,123 +2,278 @@
 #include <iostream>
 #include <cinttypes>
 #include <stdlib.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "tt.h"
 #include "defs.h"
 
-void TranspositionTable::allocate(int mb_size) {
-    // we want the size of the table to be a power of two
-    for(tt_size = 2; tt_size <= mb_size; tt_size *= 2);
-    // it works too with -1 but we would need some extra checks in the loops
-    tt_size = ((tt_size / 2) << 20) / sizeof(Entry);
-    tt_mask = tt_size - 4;
+static const char TT_FILE_MAGIC[8] = "DRATTT1";
+
+#if defined(__linux__)
+// madvise succeeds even if transparent huge pages are disabled system-wide
+static bool thp_enabled() {
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string mode;
+    std::getline(file, mode);
+    return !mode.empty() && mode.find("[never]") == std::string::npos;
+}
+#endif
+
+// With 8-64 GB tables every random probe misses the TLB unless the table sits in huge pages.
+// We first try explicit huge pages (only available if they were reserved with vm.nr_hugepages),
+// then transparent huge pages and finally normal pages.
+void TranspositionTable::allocate(int mb_size, int n_threads) {
+    // we want the number of buckets to be a power of two
+    uint64_t mb;
+    for(mb = 2; mb <= uint64_t(mb_size); mb *= 2);
+    n_buckets = ((mb / 2) << 20) / sizeof(Bucket);
+    bucket_mask = n_buckets - 1;
+    release();
+
+    // both mmap with huge pages and aligned_alloc want a multiple of the alignment
+    alloc_size = ((n_buckets * sizeof(Bucket) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+    alloc_mode = DEFAULT_PAGES;
+
+#if defined(__linux__)
+    void* mem = mmap(NULL, alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(mem != MAP_FAILED) {
+        tt = (Bucket *) mem;
+        alloc_mode = HUGETLB_PAGES;
+    } else {
+        tt = (Bucket *) aligned_alloc(HUGE_PAGE_SIZE, alloc_size);
+        if(tt != NULL && madvise(tt, alloc_size, MADV_HUGEPAGE) == 0 && thp_enabled())
+            alloc_mode = TRANSPARENT_HUGE_PAGES;
+    }
+#else
+    tt = (Bucket *) aligned_alloc(HUGE_PAGE_SIZE, alloc_size);
+#endif
+
+    if(tt == NULL) {
+        cerr << RED_COLOR << "Error allocating " << alloc_size << " bytes for the tt" << RESET_COLOR << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    clear(n_threads);
+}
+
+void TranspositionTable::release() {
+    if(tt == NULL)
+        return;
+#if defined(__linux__)
+    if(alloc_mode == HUGETLB_PAGES)
+        munmap(tt, alloc_size);
+    else
+        free(tt);
+#else
     free(tt);
-    tt = (Entry *) malloc(tt_size * sizeof(Entry));
-    clear();
+#endif
+    tt = NULL;
 }
 
-void TranspositionTable::clear() {
-    Entry* entry;
-    for(entry = tt; entry < tt + tt_size; entry++) {
-        entry->key = 0;
-        entry->depth = 0;
-        entry->date = 0;
-        entry->bound = 0;
-        entry->move = NULL_MOVE;
-        entry->score = 0;
+const char* TranspositionTable::allocation_name() const {
+    switch(alloc_mode) {
+        case HUGETLB_PAGES: return "hugetlb pages";
+        case TRANSPARENT_HUGE_PAGES: return "transparent huge pages";
+        default: return "default pages";
     }
 }
 
-bool TranspositionTable::retrieve(uint64_t& key, Move& move, int& score, int& bound, int alpha, int beta, int depth, int ply) {
-    Entry* entry;
-    entry = tt + (key & tt_mask);
-
-    for(int i = 0; i < 4; i++) {
-        if(entry->key == key) {
-            entry->date = tt_date;
-            bound = entry->bound;
-            move = entry->move;
-            if(entry->depth >= depth) {
-                score = entry->score;
+// Each thread zeroes its own slice of the table, so clearing is bound by memory bandwidth and
+// freshly allocated pages are first touched (and placed) by the threads that will search.
+void TranspositionTable::clear(int n_threads) {
+    uint64_t slice = (n_buckets + n_threads - 1) / n_threads;
+    std::vector<std::thread> threads;
+
+    for(int i = 0; i < n_threads; i++) {
+        uint64_t start = std::min(n_buckets, i * slice);
+        uint64_t end = std::min(n_buckets, start + slice);
+        if(i == n_threads - 1)
+            memset(tt + start, 0, (end - start) * sizeof(Bucket));
+        else
+            threads.emplace_back([=] { memset(tt + start, 0, (end - start) * sizeof(Bucket)); });
+    }
+
+    for(std::thread& thread : threads)
+        thread.join();
+}
+
+bool TranspositionTable::retrieve(TTStats& stats, uint64_t& key, Move& move, int& score, int& bound, int& eval, int alpha, int beta, int depth, int ply) {
+    Bucket* bucket = tt + (key & bucket_mask);
+    uint64_t data;
+    stats.probes++;
+    eval = NO_EVAL;
+
+    for(int i = 0; i < BUCKET_SIZE; i++) {
+        // another thread could be writing this entry, so we read each word only once
+        data = bucket->data[i];
+        if(bucket->keys[i] == entry_check(key, data)) {
+            stats.hits++;
+            if(entry_date(data) != tt_date) {
+                data = (data & ~(uint64_t(63) << 56)) | (uint64_t(tt_date) << 56);
+                bucket->data[i] = data;
+                bucket->keys[i] = entry_check(key, data);
+            }
+            bound = entry_bound(data);
+            move = entry_move(data);
+            eval = entry_eval(data);
+            if(entry_depth(data) >= depth) {
+                score = entry_score(data);
                 if(score <= -CHECKMATE) {
                     score += ply;
                 } else if(score >= CHECKMATE) {
                     score -= ply;
                 }
-                if((entry->bound == EXACT_BOUND)
-                || (entry->bound == UPPER_BOUND && score <= alpha)
-                || (entry->bound == LOWER_BOUND && score >= beta))
+                if((bound == EXACT_BOUND)
+                || (bound == UPPER_BOUND && score <= alpha)
+                || (bound == LOWER_BOUND && score >= beta)) {
+                    stats.cutoffs++;
                     return true;
+                }
             }
             break;
         }
-        entry++;
     }
     return false;
 }
 
-// returns true if the position was found in the table
-// bool TranspositionTable::retrieve_move(uint64_t& key, Move& move) {
-//     Entry* entry;
-//     entry = tt + (key & tt_mask);
-//     for(int i = 0; i < 4; i++) {
-//         if(entry->key == key) {
-//             entry->date = tt_date;
-//             move = entry->move;
-//             return true;
-//         }
-//         entry++;
-//     }
-//     return false;
-// } 
-
-void TranspositionTable::save(uint64_t key, Move move, int score, int bound, int depth, int ply) {
-    Entry *entry, *replace = NULL;
-    entry = tt + (key & tt_mask);
-    int oldest = -1, age;
-    total_tried_save++;
-
-    for(int i = 0; i < 4; i++) {
-        if(entry->move == NULL_MOVE || bound == EXACT_BOUND) {
-            replace = entry;
-            totally_replaced++;
+void TranspositionTable::save(TTStats& stats, uint64_t key, Move move, int score, int bound, int depth, int ply, int eval) {
+    Bucket* bucket = tt + (key & bucket_mask);
+    int replace = -1, oldest = -1, age, reason = REPLACE_OLDEST;
+    uint64_t data;
+
+    // the position keeps a single entry, wherever it is in the bucket
+    for(int i = 0; i < BUCKET_SIZE; i++) {
+        data = bucket->data[i];
+        if(entry_move(data) != NULL_MOVE && bucket->keys[i] == entry_check(key, data)) {
+            replace = i;
+            reason = REPLACE_SAME_POSITION;
+            break;
+        }
+    }
+
+    for(int i = 0; i < BUCKET_SIZE && reason != REPLACE_SAME_POSITION; i++) {
+        data = bucket->data[i];
+        if(entry_move(data) == NULL_MOVE) {
+            replace = i;
+            reason = REPLACE_EMPTY;
+            break;
+        } else if(bound == EXACT_BOUND) {
+            replace = i;
+            reason = REPLACE_EXACT;
             break;
         }
         // we determine which entry is more valuable
-        age = ((tt_date - entry->date) & 255) * 256 + 255 - entry->depth;
+        age = ((tt_date - entry_date(data)) & 63) * 256 + 255 - entry_depth(data);
         if(age > oldest) {
-            replace = entry;
+            replace = i;
             oldest = age;
         } 
-        entry++;
     }
 
-    if(replace != NULL) {
-        total_saved++;
-        replace->key = key;
-        replace->depth = depth;
-        replace->date = tt_date;
-        replace->bound = bound;
-        replace->move = move;
-        replace->score = score;
+    if(replace != -1) {
+        stats.stores++;
+        stats.replaced[reason]++;
+        data = pack_entry(move, score, eval, depth, tt_date, bound);
+        bucket->data[replace] = data;
+        bucket->keys[replace] = entry_check(key, data);
+    }
+}
+
+// permille of the first entries written during the current search, cheap enough for every info line
+int TranspositionTable::hashfull() const {
+    const uint64_t n_samples = std::min(n_buckets, uint64_t(200));
+    int n_full = 0;
+    for(Bucket* bucket = tt; bucket < tt + n_samples; bucket++) {
+        for(int i = 0; i < BUCKET_SIZE; i++) {
+            if(bucket->data[i] && entry_date(bucket->data[i]) == tt_date)
+                n_full++;
+        }
+    }
+    return int(n_full * 1000 / (n_samples * BUCKET_SIZE));
+}
+
+static double percentage(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0.0;
+}
+
+void TranspositionTable::print_stats() const {
+    printf("info string tt probes %" PRIu64 " hits %" PRIu64 " (%.1f%%) cutoffs %" PRIu64 " (%.1f%%) collisions %" PRIu64 "\n",
+           stats.probes, stats.hits, percentage(stats.hits, stats.probes),
+           stats.cutoffs, percentage(stats.cutoffs, stats.probes), stats.collisions);
+    printf("info string tt stores %" PRIu64 " replaced empty %" PRIu64 " same %" PRIu64 " exact %" PRIu64 " oldest %" PRIu64 " hashfull %d\n",
+           stats.stores, stats.replaced[REPLACE_EMPTY], stats.replaced[REPLACE_SAME_POSITION],
+           stats.replaced[REPLACE_EXACT], stats.replaced[REPLACE_OLDEST], hashfull());
+    fflush(stdout);
+}
+
+// We dump the table through a shared mapping of the file and load it back with a read-only one,
+// so a warm restart only costs copying the pages, which are probably still in the page cache.
+bool TranspositionTable::save_file(const char* path, uint64_t fingerprint) const {
+    const size_t table_size = n_buckets * sizeof(Bucket);
+    const size_t size = sizeof(TTFileHeader) + table_size;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1)
+        return false;
+    if(ftruncate(fd, size) == -1) {
+        close(fd);
+        return false;
     }
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return false;
+
+    TTFileHeader* header = (TTFileHeader *) data;
+    memset(header, 0, sizeof(TTFileHeader));
+    memcpy(header->magic, TT_FILE_MAGIC, sizeof(header->magic));
+    header->fingerprint = fingerprint;
+    header->n_buckets = n_buckets;
+    header->bucket_bytes = sizeof(Bucket);
+    header->date = tt_date;
+    memcpy(header + 1, tt, table_size);
+
+    munmap(data, size);
+    return true;
 }
 
-int TranspositionTable::how_full() const {
-    Entry* entry;
-    int n_full = 0, n_checks = 1;
-    // for(entry = tt; entry < tt + 20000 && entry < tt + tt_size; entry++) {
-    for(entry = tt; entry < tt + tt_size; entry++) {
-        n_checks++;
-        if(entry->move != NULL_MOVE)
-            n_full++;
+bool TranspositionTable::load_file(const char* path, uint64_t fingerprint, int n_threads) {
+    int fd = open(path, O_RDONLY);
+    if(fd == -1)
+        return false;
+    struct stat statbuf;
+    fstat(fd, &statbuf);
+    const size_t size = statbuf.st_size;
+    void* data = size >= sizeof(TTFileHeader) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(data == MAP_FAILED)
+        return false;
+
+    const TTFileHeader* header = (const TTFileHeader *) data;
+    const uint64_t saved_buckets = header->n_buckets;
+    bool valid = memcmp(header->magic, TT_FILE_MAGIC, sizeof(header->magic)) == 0
+              && header->fingerprint == fingerprint
+              && header->bucket_bytes == sizeof(Bucket)
+              && saved_buckets && !(saved_buckets & (saved_buckets - 1))
+              && size == sizeof(TTFileHeader) + saved_buckets * sizeof(Bucket)
+              && ((saved_buckets * sizeof(Bucket)) >> 20);
+
+    if(valid) {
+        madvise(data, size, MADV_SEQUENTIAL);
+        if(saved_buckets != n_buckets)
+            allocate(int((saved_buckets * sizeof(Bucket)) >> 20), n_threads);
+        memcpy(tt, header + 1, n_buckets * sizeof(Bucket));
+        tt_date = header->date & 63;
     }
-    // return n_full;
-    // cout << "TT size is " << tt_size << endl;
-    // cout << "TT mask is " << tt_mask << endl;
-    // cout << "There are " << n_full << " in TT" << endl;
-    // cout << "Total tried to save is " << total_tried_save << endl;
-    // cout << "Total saved is " << total_saved << endl;
-    // cout << "n_full is " << n_full << endl;
-    cout << "Of " << n_checks << " just " << n_full << " are occupied" << endl;
-    return (n_full * 100) / n_checks;
+
+    munmap(data, size);
+    return valid;
 }
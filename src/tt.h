@@ -11,29 +11,113 @@ enum Bound {
   EXACT_BOUND
 };
 
-struct Entry {
-    uint64_t key;
-    uint8_t depth;  
-    uint8_t date;
-    uint8_t bound;
-    int16_t move;
-    int16_t score;
+const int BUCKET_SIZE = 5;
+const int NO_EVAL = -INF;
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+enum ReplaceReason {
+  REPLACE_EMPTY,
+  REPLACE_SAME_POSITION,
+  REPLACE_EXACT,
+  REPLACE_OLDEST,
+  N_REPLACE_REASONS
+};
+
+// Every search thread counts into its own stats so that probing doesn't bounce a shared cache line
+// between threads. They are summed into the table's stats when the search is over.
+struct TTStats {
+    uint64_t probes, hits, cutoffs, stores, collisions;
+    uint64_t replaced[N_REPLACE_REASONS];
+
+    TTStats() {
+        probes = hits = cutoffs = stores = collisions = 0;
+        for(int i = 0; i < N_REPLACE_REASONS; i++)
+            replaced[i] = 0;
+    }
+
+    void add(const TTStats& other) {
+        probes += other.probes;
+        hits += other.hits;
+        cutoffs += other.cutoffs;
+        stores += other.stores;
+        collisions += other.collisions;
+        for(int i = 0; i < N_REPLACE_REASONS; i++)
+            replaced[i] += other.replaced[i];
+    }
+};
+
+// Saved tables start with this header, it is a cache line long so that the buckets stay aligned.
+struct TTFileHeader {
+    char magic[8];
+    uint64_t fingerprint, n_buckets;
+    uint32_t bucket_bytes, date;
+    uint8_t padding[32];
 };
+static_assert(sizeof(TTFileHeader) == 64, "The header should fill a cache line");
+
+enum AllocationMode {
+  DEFAULT_PAGES,
+  TRANSPARENT_HUGE_PAGES,
+  HUGETLB_PAGES
+};
+
+// A bucket fills exactly one cache line, so a probe costs a single memory access.
+// All the fields of an entry are packed in a single 64-bit word and we only keep the 32 upper
+// bits of the key (the lower ones give the bucket index), xored with both halves of the data.
+// If two threads write the same entry at the same time the key won't match the data anymore
+// and the entry will be ignored, so the table doesn't need any locks.
+// data layout: move (16 bits) | score (16) | static eval (16) | depth (8) | date (6) | bound (2)
+struct alignas(64) Bucket {
+    uint32_t keys[BUCKET_SIZE];
+    uint32_t padding;
+    uint64_t data[BUCKET_SIZE];
+};
+
+static_assert(sizeof(Bucket) == 64, "Bucket must fill a cache line");
+
+inline uint64_t pack_entry(Move move, int score, int eval, int depth, int date, int bound) {
+    return uint64_t(move)
+        | (uint64_t(uint16_t(score)) << 16)
+        | (uint64_t(uint16_t(eval)) << 32)
+        | (uint64_t(uint8_t(depth)) << 48)
+        | (uint64_t(date & 63) << 56)
+        | (uint64_t(bound & 3) << 62);
+}
+
+inline uint32_t entry_check(uint64_t key, uint64_t data) {
+    return uint32_t(key >> 32) ^ uint32_t(data) ^ uint32_t(data >> 32);
+}
+
+#define entry_move(data) uint16_t((data) & 0xffff)
+#define entry_score(data) int(int16_t(((data) >> 16) & 0xffff))
+#define entry_eval(data) int(int16_t(((data) >> 32) & 0xffff))
+#define entry_depth(data) int(((data) >> 48) & 0xff)
+#define entry_date(data) int(((data) >> 56) & 63)
+#define entry_bound(data) int((data) >> 62)
 
 class TranspositionTable {  
 public:
-    void allocate(int mb_size);
-    void clear();
-    int size() const { return tt_size; }
-    void age() { tt_date = (tt_date + 1) & 255; }
-    int how_full() const;
-    bool retrieve(uint64_t& key, Move& move, int& score, int& bound, int alpha, int beta, int depth, int ply);
+    void allocate(int mb_size, int n_threads = 1);
+    void release();
+    void clear(int n_threads = 1);
+    const char* allocation_name() const;
+    uint64_t size() const { return n_buckets * BUCKET_SIZE; }
+    void age() { tt_date = (tt_date + 1) & 63; }
+    // start loading the bucket of a position we are about to probe
+    void prefetch(uint64_t key) const { __builtin_prefetch(tt + (key & bucket_mask)); }
+    int hashfull() const;
+    void print_stats() const;
+    bool save_file(const char* path, uint64_t fingerprint) const;
+    bool load_file(const char* path, uint64_t fingerprint, int n_threads = 1);
+    // eval is the static eval stored with the entry, NO_EVAL if there is no entry or it has none
+    bool retrieve(TTStats& stats, uint64_t& key, Move& move, int& score, int& bound, int& eval, int alpha, int beta, int depth, int ply);
     // bool retrieve_move(int64_t& key, Move& move);
-    void save(uint64_t key, Move move, int score, int bound, int depth, int ply);
-    int total_saved, total_tried_save, totally_replaced;
-    // static_assert(sizeof(Entry) == 16, "Entry must have size 16");
-    int tt_size, tt_mask, tt_date;
-    Entry* tt; 
+    void save(TTStats& stats, uint64_t key, Move move, int score, int bound, int depth, int ply, int eval = NO_EVAL);
+    TTStats stats;
+    uint64_t n_buckets, bucket_mask;
+    size_t alloc_size;
+    int tt_date, alloc_mode;
+    Bucket* tt; 
 };
 
 extern TranspositionTable tt;
@@ -2,12 +2,15 @@
 #include <pthread.h>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
 #include "board.h"
 #include "search.h"
 #include "new_search.h"
 #include "defs.h"
 #include "tt.h"
 #include "engine.h"
+#include "nnue.h"
+#include "bench.h"
 
 // Commands we get:
 // * uci
@@ -21,6 +24,11 @@
 // * stop
 // * ponderhit
 // * quit
+// and our own:
+// * print
+// * ttstats (tt usage since the last ucinewgame)
+// * savehash <file>, loadhash <file>
+// * perft <depth> [divide] [threads <n>] [hash <mb>] (from the current position)
 // Engine engine; // engine will be a global object
 
 enum {
@@ -69,9 +77,48 @@ void* process_go(void* _go_struct) {
     }
 }
 
+// the net is loaded when the gui asks whether we are ready, after it has set the options, so the
+// first search doesn't pay for it. A net that doesn't load leaves the previous one in use.
+static std::string eval_file = NNUE_PATH, tried_eval_file, loaded_eval_file;
+
+void load_eval_file() {
+    if(eval_file == tried_eval_file)
+        return;
+    // we don't retry a file that didn't load until the option changes
+    tried_eval_file = eval_file;
+    if(nnue_load(eval_file.c_str())) {
+        loaded_eval_file = eval_file;
+        tt.clear(engine.threads); // the entries keep static evals of the previous net
+        cout << "info string nnue loaded " << eval_file << endl;
+    } else if(loaded_eval_file.empty())
+        cout << "info string nnue failed to load " << eval_file << ", no net loaded" << endl;
+    else
+        cout << "info string nnue failed to load " << eval_file << ", still using " << loaded_eval_file << endl;
+}
+
+void allocate_hash(int mb_size) {
+    tt.allocate(mb_size, engine.threads);
+    cout << "info string hash " << (tt.n_buckets * sizeof(Bucket) >> 20) << " MB using " << tt.allocation_name() << endl;
+}
+
+// setoption name <id> value <x>
 void parse_option(const std::vector<std::string>& args) {
-    cout << "Parsing some option..." << endl;
-    // (not doing anything)
+    if(args.size() < 5 || args[1] != "name" || args[3] != "value") {
+        cerr << "Invalid setoption command" << endl;
+        return;
+    }
+    if(args[2] == "Threads") {
+        engine.threads = std::max(1, std::min(MAX_THREADS, atoi(args[4].c_str())));
+    } else if(args[2] == "Hash") {
+        allocate_hash(std::max(1, std::min(MAX_HASH, atoi(args[4].c_str()))));
+    } else if(args[2] == "EvalFile") {
+        // the path may have spaces
+        eval_file = args[4];
+        for(int i = 5; i < (int)args.size(); i++)
+            eval_file += " " + args[i];
+    } else {
+        cerr << "Unknown option " << args[2] << endl;
+    }
 }
 
 void uci() {
@@ -84,13 +131,16 @@ void uci() {
 
     cout << "id name Dratini NNUE" << endl;
     cout << "id author Oscar Balcells" << endl;
+    cout << "option name Threads type spin default 1 min 1 max " << MAX_THREADS << endl;
+    cout << "option name Hash type spin default 16 min 1 max " << MAX_HASH << endl;
+    cout << "option name EvalFile type string default " << NNUE_PATH << endl;
     cout << "uciok" << endl;
 
-    engine = Engine();
+    engine.reset();
     pthread_t pthread_go;
     std::string line, command;
     std::vector<std::string> args;
-    tt.allocate(16);
+    allocate_hash(16);
 
     while(true) {
         getline(cin, line);
@@ -112,13 +162,15 @@ void uci() {
         if(command == "debug") {
 
         } else if(command == "isready") {
+            load_eval_file();
             cout << "readyok" << endl;
             cerr << "readyok" << endl;
         } else if(command == "setoption") {
             parse_option(args);
         } else if(command == "ucinewgame") {
             engine.set_position();
-            tt.clear();
+            tt.clear(engine.threads);
+            tt.stats = TTStats();
         } else if(command == "position") {
             engine.is_searching = false; // stop the search and don't return bestmove
             if(args[1] == "startpos") {
@@ -167,6 +219,11 @@ void uci() {
             // go_struct->param_name = MOVETIME;
             // go_struct->param_value = 0;
             // pthread_create(&pthread_go, NULL, &process_go, go_struct);
+            load_eval_file(); // in case the gui changed the net and didn't ask whether we are ready
+            if(loaded_eval_file.empty()) {
+                cout << "info string error no nnue loaded, set EvalFile to a net" << endl;
+                continue;
+            }
             engine.is_searching = true;
             engine.stop_search = false;
             think(engine);
@@ -174,8 +231,6 @@ void uci() {
             if(engine.is_searching) {
                 assert(engine.best_move != NULL_MOVE);
                 cout << "bestmove " << move_to_str(engine.best_move) << " ponder " << move_to_str(engine.ponder_move) << endl;
-                // printf("TT percentage: %d percent, totally tried save %d, totally replaced %d, total saved %d\n",
-                // tt.how_full(), tt.total_tried_save, tt.totally_replaced, tt.total_saved);
                 // cerr << "out: bestmove " << move_to_str(engine.best_move) << " ponder " << move_to_str(engine.ponder_move) << endl;
                 engine.is_searching = false;
             }
@@ -185,6 +240,20 @@ void uci() {
             // engine.is_pondering = false;
         } else if(command == "print") {
             engine.board.print_board();
+        } else if(command == "ttstats") {
+            tt.print_stats();
+        } else if(command == "savehash" || command == "loadhash") {
+            std::string path = line.substr(std::min(line.size(), command.size() + 1));
+            bool success = command == "savehash"
+                ? tt.save_file(path.c_str(), zobrist_fingerprint())
+                : tt.load_file(path.c_str(), zobrist_fingerprint(), engine.threads);
+            cout << "info string " << (command == "savehash" ? "saving" : "loading") << " hash " << path;
+            if(success)
+                cout << " done, " << (tt.n_buckets * sizeof(Bucket) >> 20) << " MB" << endl;
+            else
+                cout << " failed" << endl;
+        } else if(command == "perft") {
+            perft_command(std::vector<std::string>(args.begin() + 1, args.end()), engine.board);
         } else if(command == "quit") {
             return;
         }
@@ -31,7 +31,7 @@ void test_make_move_speed() {
 
 		// we generate the list of moves
 		for (int move_idx = 0; move_idx < 200; move_idx++) {
-			std::vector < Move > generated_moves;
+			MoveList generated_moves;
 			generate_moves(generated_moves, & first_board, false);
 			if (generated_moves.empty() || first_board.fifty_move_ply >= 50)
 				break;
@@ -85,7 +85,8 @@ void test_move_valid_speed() {
 	std::vector<Move> moves;
 	Board board = Board();
 	UndoData _undo_data = UndoData(board.king_attackers);
-	std::vector<Move> raw_moves, valid_moves;
+	MoveList raw_moves;
+	std::vector<Move> valid_moves;
 	int move_picked;
 	Move move;
 
@@ -271,7 +272,8 @@ void test_see_speed() {
 	};
 	std::uniform_int_distribution < uint64_t > dist(std::llround(std::pow(2, 56)), std::llround(std::pow(2, 62)));
 	std::chrono::time_point < std::chrono::high_resolution_clock > initial_time, end_time;
-	std::vector<Move> raw_moves, valid_moves;
+	MoveList raw_moves;
+	std::vector<Move> valid_moves;
 	Board board = Board();
 	UndoData _undo_data = UndoData(board.king_attackers);
 	int score, move_picked;
@@ -289,7 +291,6 @@ void test_see_speed() {
 		for(int move_idx = 0; move_idx < 200; move_idx++) {
 			raw_moves.clear();
 			valid_moves.clear();
-			raw_moves.reserve(64);
 			valid_moves.reserve(64);
 
 			generate_captures(raw_moves, &board);
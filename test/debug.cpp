@@ -130,10 +130,9 @@ uint64_t new_perft(Board& board, int depth) {
     return ans;
 }
 
-// using new board functions but vector for storing moves
+// using new board functions but a MoveList for storing moves
 uint64_t old_perft(Board& board, int depth) {
-    std::vector<Move> moves;
-    moves.reserve(128);
+    MoveList moves;
     generate_captures(moves, &board);
     generate_quiet(moves, &board);
     if(depth == max_depth)
@@ -163,7 +162,7 @@ void perft_check(Board& board, POS* pos, int depth) {
     GenerateCaptures(pos, s1_moves);
     int* s_last = GenerateQuiet(pos, s1_moves);
 
-    std::vector<Move> d3_moves, s3_moves;
+    MoveList d3_moves, s3_moves;
 
     for(Move* movep = d1_moves; movep < d_last; movep++) {
         // cerr << "Making move " << move_to_str(*movep) << " f " << (int)get_flag(*movep) << endl;
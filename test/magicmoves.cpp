@@ -0,0 +1,57 @@
+#include <random>
+#include "catch.h"
+#include "../src/magicmoves.h"
+
+// the attacks of a slider found the slow way, walking each ray until it hits a piece
+static U64 ray_attacks(int sq, U64 occupancy, const int directions[4][2]) {
+    U64 attacks = 0;
+    for(int i = 0; i < 4; i++) {
+        int rank = sq / 8 + directions[i][0], file = sq % 8 + directions[i][1];
+        while(rank >= 0 && rank < 8 && file >= 0 && file < 8) {
+            attacks |= 1ULL << (rank * 8 + file);
+            if(occupancy & (1ULL << (rank * 8 + file)))
+                break;
+            rank += directions[i][0];
+            file += directions[i][1];
+        }
+    }
+    return attacks;
+}
+
+static const int bishop_directions[4][2] = { {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+static const int rook_directions[4][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+
+// On a bmi2 build (make tests ARCH=bmi2) Bmagic and Rmagic are the pext lookups, so this checks
+// the pext tables against the same attacks the magics give.
+TEST_CASE("Slider attacks match the attacks along the rays") {
+    initmagicmoves();
+    std::mt19937_64 rng(2022);
+
+    for(int sq = 0; sq < 64; sq++) {
+        REQUIRE(Bmagic(sq, 0) == ray_attacks(sq, 0, bishop_directions));
+        REQUIRE(Rmagic(sq, 0) == ray_attacks(sq, 0, rook_directions));
+
+        for(int i = 0; i < 4000; i++) {
+            // from nearly empty to nearly full boards
+            U64 occupancy = rng();
+            if(i % 4 == 1)
+                occupancy &= rng();
+            else if(i % 4 == 2)
+                occupancy &= rng() & rng();
+            else if(i % 4 == 3)
+                occupancy |= rng();
+
+            const U64 bishop = ray_attacks(sq, occupancy, bishop_directions);
+            const U64 rook = ray_attacks(sq, occupancy, rook_directions);
+            if(Bmagic(sq, occupancy) != bishop || Rmagic(sq, occupancy) != rook
+            || BmagicNOMASK(sq, occupancy & magicmoves_b_mask[sq]) != bishop
+            || RmagicNOMASK(sq, occupancy & magicmoves_r_mask[sq]) != rook) {
+                INFO("square " << sq << " occupancy " << occupancy);
+                REQUIRE(Bmagic(sq, occupancy) == bishop);
+                REQUIRE(Rmagic(sq, occupancy) == rook);
+                REQUIRE(BmagicNOMASK(sq, occupancy & magicmoves_b_mask[sq]) == bishop);
+                REQUIRE(RmagicNOMASK(sq, occupancy & magicmoves_r_mask[sq]) == rook);
+            }
+        }
+    }
+}
@@ -1,3 +1,96 @@
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "catch.h"
+
+#include "../src/defs.h"
+#include "../src/board.h"
+#include "../src/gen.h"
+
+static const char* perft_fens[6] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10"
+};
+
+TEST_CASE("Perft of the standard positions") {
+    Board board;
+
+    SECTION("Start position") {
+        board = Board(perft_fens[0]);
+        REQUIRE(perft(board, 5) == 4865609);
+    }
+    SECTION("Kiwipete") {
+        board = Board(perft_fens[1]);
+        REQUIRE(perft(board, 4) == 4085603);
+    }
+    SECTION("Position 3") {
+        board = Board(perft_fens[2]);
+        REQUIRE(perft(board, 6) == 11030083);
+    }
+    SECTION("Position 4") {
+        board = Board(perft_fens[3]);
+        REQUIRE(perft(board, 5) == 15833292);
+    }
+    SECTION("Position 5") {
+        board = Board(perft_fens[4]);
+        REQUIRE(perft(board, 4) == 2103487);
+    }
+    SECTION("Position 6") {
+        board = Board(perft_fens[5]);
+        REQUIRE(perft(board, 4) == 3894594);
+    }
+}
+
+// the pseudo-legal generators filtered by fast_move_valid
+static std::vector<Move> filtered_moves(const Board& board) {
+    MoveList raw_moves;
+    std::vector<Move> moves;
+    generate_captures(raw_moves, &board);
+    generate_quiet(raw_moves, &board);
+    for(Move move : raw_moves) {
+        if(board.fast_move_valid(move))
+            moves.push_back(move);
+    }
+    std::sort(moves.begin(), moves.end());
+    return moves;
+}
+
+TEST_CASE("The legal generator agrees with the pseudo-legal one") {
+    std::mt19937 rng(2021);
+    Move legal_moves[MAX_MOVES];
+    int n_positions = 0;
+
+    for(int fen_idx = 0; fen_idx < 6; fen_idx++) {
+        for(int game_idx = 0; game_idx < 50; game_idx++) {
+            Board board = Board(perft_fens[fen_idx]);
+            UndoData undo_data = UndoData(board.king_attackers);
+            std::string played;
+
+            for(int ply = 0; ply < 60; ply++) {
+                Move* last = generate_legal_moves(legal_moves, &board);
+                std::vector<Move> moves(legal_moves, last);
+                std::sort(moves.begin(), moves.end());
+                if(moves != filtered_moves(board)) {
+                    INFO(perft_fens[fen_idx] << " moves" << played);
+                    REQUIRE(moves == filtered_moves(board));
+                }
+                n_positions++;
+
+                if(moves.empty())
+                    break;
+                const Move move = moves[rng() % moves.size()];
+                played += " " + move_to_str(move);
+                board.new_make_move(move, undo_data);
+            }
+        }
+    }
+    REQUIRE(n_positions > 10000);
+}
+
 // #include <vector>
 // #include <random>
 // #include <algorithm>
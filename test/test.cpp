@@ -1,5 +1,7 @@
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
 #include "catch.h"
 #include "../src/tt.h"
+#include "../src/engine.h"
 
 TranspositionTable tt;
+Engine engine;
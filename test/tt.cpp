@@ -0,0 +1,57 @@
+#include "catch.h"
+#include "../src/defs.h"
+#include "../src/tt.h"
+
+static void check_round_trip(Move move, int score, int eval, int depth, int date, int bound) {
+    const uint64_t data = pack_entry(move, score, eval, depth, date, bound);
+    REQUIRE(entry_move(data) == move);
+    REQUIRE(entry_score(data) == score);
+    REQUIRE(entry_eval(data) == eval);
+    REQUIRE(entry_depth(data) == depth);
+    REQUIRE(entry_date(data) == date);
+    REQUIRE(entry_bound(data) == bound);
+}
+
+TEST_CASE("Packed tt entries keep every field") {
+    const Move move = Move(12, 28, QUIET_MOVE);
+
+    SECTION("Negative scores and evals") {
+        check_round_trip(move, -1, -1, 1, 0, UPPER_BOUND);
+        check_round_trip(move, -250, -1234, 7, 5, LOWER_BOUND);
+    }
+
+    SECTION("No static eval") {
+        check_round_trip(move, 35, NO_EVAL, 3, 10, EXACT_BOUND);
+        check_round_trip(move, -35, NO_EVAL, 0, 63, NONE);
+    }
+
+    SECTION("Mate scores") {
+        check_round_trip(move, CHECKMATE + MAX_PLY, 20, MAX_PLY, 1, EXACT_BOUND);
+        check_round_trip(move, -CHECKMATE - MAX_PLY, -20, MAX_PLY, 1, EXACT_BOUND);
+        check_round_trip(move, INF, -INF, 255, 63, LOWER_BOUND);
+    }
+
+    SECTION("Every bit of the move") {
+        check_round_trip(Move(63, 63, 15), -INF, INF, 255, 63, EXACT_BOUND);
+        check_round_trip(NULL_MOVE, 0, 0, 0, 0, NONE);
+    }
+
+    SECTION("The date wraps around after 63") {
+        const uint64_t data = pack_entry(move, 0, 0, 1, 64, EXACT_BOUND);
+        REQUIRE(entry_date(data) == 0);
+        REQUIRE(entry_bound(data) == EXACT_BOUND);
+        REQUIRE(entry_depth(data) == 1);
+        // an entry of the previous search is one search old across the wrap, as save() ages it
+        REQUIRE(((0 - entry_date(pack_entry(move, 0, 0, 1, 63, EXACT_BOUND))) & 63) == 1);
+    }
+}
+
+TEST_CASE("The check of a packed entry depends on the key and all the data") {
+    const uint64_t key = 0x123456789abcdef0ULL;
+    const uint64_t data = pack_entry(Move(12, 28, QUIET_MOVE), -150, 40, 9, 17, LOWER_BOUND);
+    REQUIRE(entry_check(key, data) == entry_check(key, data));
+    REQUIRE(entry_check(key ^ (1ULL << 40), data) != entry_check(key, data));
+    for(int bit = 0; bit < 64; bit++) {
+        REQUIRE(entry_check(key, data ^ (1ULL << bit)) != entry_check(key, data));
+    }
+}